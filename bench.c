@@ -0,0 +1,419 @@
+/* Benchmark driver for myjql */
+/* Compile: gcc -o bench bench.c -O2 -lm */
+/* Run: ./bench --ops=1000000 --mix=50:40:10 --dist=zipf >> results.jsonl */
+/* Options: --ops=N          statements to run (default 1000000)
+            --mix=I:S:D      insert:select:delete weights (default 50:40:10)
+            --dist=D         key distribution, uniform, zipf or sequential (default uniform)
+            --theta=T        skew of the zipf distribution (default 0.99)
+            --dup=K          rows per distinct b on average (default 1)
+            --keys=N         distinct b values, overrides --dup
+            --seed=S         seed of the generator (default 1)
+            --bin=PATH       myjql to run (default ./myjql), make bench builds ./myjql_bench with -O2
+            --db=PATH        db file, removed before and after the run (default bench.db)
+            --label=STR      copied into the result, e.g. the git revision
+            --workload=FILE  only write the statements to FILE ("-" for stdout), for replaying by hand
+   everything after `--` is passed on to myjql, e.g. -- --frames=64 --mmap
+   the result is one JSON object per run on stdout */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define MAX_PASSED_ARGS 16
+#define STATEMENT_SIZE 32 // fits the 31 byte input buffer of myjql
+#define LINE_SIZE 256
+
+typedef enum { DIST_UNIFORM, DIST_ZIPF, DIST_SEQUENTIAL } Distribution;
+
+struct {
+  uint64_t ops;
+  uint32_t mix[3]; // insert, select, delete
+  Distribution dist;
+  double theta;
+  uint32_t dup;
+  uint64_t keys;
+  uint64_t seed;
+  const char* bin;
+  const char* db;
+  const char* label;
+  const char* workload;
+  char* passed[MAX_PASSED_ARGS];
+  uint32_t num_passed;
+} options = {1000000, {50, 40, 10}, DIST_UNIFORM, 0.99, 1, 0, 1, "./myjql", "bench.db", "", NULL, {NULL}, 0};
+
+const char* dist_names[] = {"uniform", "zipf", "sequential"};
+const char* statement_names[] = {"insert", "select", "delete"};
+
+/*---------- Workload Generator --------------*/
+
+uint64_t rng_state;
+
+// splitmix64, the same seed gives the same workload everywhere
+uint64_t rng_next () {
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double rng_double () {
+  return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* zipf over [0, keys) as in YCSB (Gray et al., Quickly Generating Billion-Record Synthetic
+ * Databases), rank 0 is the hottest. ranks are scrambled so the hot keys are spread over
+ * the tree instead of sitting in one leaf */
+struct {
+  double zetan;
+  double alpha;
+  double eta;
+  double half_pow_theta;
+} zipf;
+
+void zipf_init (uint64_t n, double theta) {
+  double zetan = 0;
+  for (uint64_t i = 1; i <= n; ++i) {
+    zetan += 1.0 / pow((double)i, theta);
+  }
+  double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+  zipf.zetan = zetan;
+  zipf.alpha = 1.0 / (1.0 - theta);
+  zipf.eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  zipf.half_pow_theta = 1.0 + pow(0.5, theta);
+}
+
+uint64_t zipf_next (uint64_t n) {
+  double u = rng_double();
+  double uz = u * zipf.zetan;
+  uint64_t rank;
+  if (uz < 1.0) {
+    rank = 0;
+  }
+  else if (uz < zipf.half_pow_theta) {
+    rank = 1;
+  }
+  else {
+    rank = (uint64_t)(n * pow(zipf.eta * u - zipf.eta + 1.0, zipf.alpha));
+  }
+  if (rank >= n) {
+    rank = n - 1;
+  }
+  // FNV-1a of the rank
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (uint32_t i = 0; i < 8; ++i) {
+    hash = (hash ^ ((rank >> (i * 8)) & 0xFF)) * 0x100000001B3ULL;
+  }
+  return hash % n;
+}
+
+uint64_t sequence[3]; // sequential mode walks the keys once per statement type
+
+uint64_t next_key (uint32_t type) {
+  switch (options.dist) {
+    case DIST_ZIPF:
+      return zipf_next(options.keys);
+    case DIST_SEQUENTIAL:
+      return sequence[type]++ % options.keys;
+    default:
+      return rng_next() % options.keys;
+  }
+}
+
+uint32_t next_type () {
+  uint64_t pick = rng_next() % (options.mix[0] + options.mix[1] + options.mix[2]);
+  if (pick < options.mix[0]) {
+    return 0;
+  }
+  return pick < options.mix[0] + options.mix[1] ? 1 : 2;
+}
+
+// b is the key spelled in 11 lowercase letters, so sequential keys are also sorted
+void key_to_b (uint64_t key, char* b) {
+  for (int32_t i = 10; i >= 0; --i) {
+    b[i] = 'a' + key % 26;
+    key /= 26;
+  }
+  b[11] = '\0';
+}
+
+// writes options.ops statements and `.exit` to fd
+void generate (int fd) {
+  FILE* out = fdopen(fd, "w");
+  if (out == NULL) {
+    printf("Error opening workload: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  rng_state = options.seed;
+  memset(sequence, 0, sizeof(sequence));
+  char b[12];
+  for (uint64_t i = 0; i < options.ops; ++i) {
+    uint32_t type = next_type();
+    key_to_b(next_key(type), b);
+    if (type == 0) {
+      fprintf(out, "insert %u %s\n", (uint32_t)(rng_next() % 1000000), b);
+    }
+    else {
+      fprintf(out, "%s %s\n", statement_names[type], b);
+    }
+  }
+  fprintf(out, ".exit\n");
+  if (fclose(out) != 0) {
+    printf("Error writing workload: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*---------- Driver --------------*/
+
+/* myjql runs with --batch --stats, its `.stats` report at close is where the latencies and
+ * counters come from. the selected rows are read and thrown away */
+
+typedef struct {
+  uint64_t count, mean, p50, p90, p99, p999, max;
+} Latency;
+
+struct {
+  Latency latency[3];
+  uint64_t page_reads, page_writes;
+  uint64_t cache_hits, cache_misses;
+  uint64_t leaf_splits, internal_splits, merges, redistributions;
+  uint32_t height;
+  bool seen_stats;
+} result;
+
+void parse_line (char* line) {
+  char name[16];
+  Latency l;
+  if (sscanf(line, "%15s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+             name, &l.count, &l.mean, &l.p50, &l.p90, &l.p99, &l.p999, &l.max) == 8) {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (strcmp(name, statement_names[i]) == 0) {
+        result.latency[i] = l;
+        result.seen_stats = true;
+      }
+    }
+    return;
+  }
+  uint32_t pages;
+  if (sscanf(line, "pages: %u in file, %" SCNu64 " read, %" SCNu64 " written",
+             &pages, &result.page_reads, &result.page_writes) == 3) {
+    return;
+  }
+  if (sscanf(line, "cache: %" SCNu64 " hits, %" SCNu64 " misses", &result.cache_hits, &result.cache_misses) == 2) {
+    return;
+  }
+  if (sscanf(line, "tree: %" SCNu64 " leaf splits, %" SCNu64 " internal splits, %" SCNu64 " merges, %" SCNu64 " redistributions",
+             &result.leaf_splits, &result.internal_splits, &result.merges, &result.redistributions) == 4) {
+    return;
+  }
+  sscanf(line, "height: %u", &result.height);
+}
+
+void check (int ret, const char* what) {
+  if (ret == -1) {
+    printf("Error %s: %d\n", what, errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+double now_seconds () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// s inside a JSON string: quotes, backslashes and control characters escaped
+void print_json_chars (const char* s) {
+  for (; *s; ++s) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    }
+    else if (c < 0x20) {
+      printf("\\u%04x", c);
+    }
+    else {
+      putchar(c);
+    }
+  }
+}
+
+void print_json_string (const char* s) {
+  putchar('"');
+  print_json_chars(s);
+  putchar('"');
+}
+
+void run () {
+  int to_db[2], from_db[2];
+  check(pipe(to_db), "creating pipe");
+  check(pipe(from_db), "creating pipe");
+  unlink(options.db);
+
+  double start = now_seconds();
+  pid_t db = fork();
+  check(db, "forking myjql");
+  if (db == 0) {
+    dup2(to_db[0], STDIN_FILENO);
+    dup2(from_db[1], STDOUT_FILENO);
+    close(to_db[0]); close(to_db[1]);
+    close(from_db[0]); close(from_db[1]);
+    char* argv[MAX_PASSED_ARGS + 5] = {(char*)options.bin, (char*)options.db, "--batch", "--stats"};
+    memcpy(argv + 4, options.passed, options.num_passed * sizeof(char*));
+    execv(options.bin, argv);
+    printf("Error running %s: %d\n", options.bin, errno);
+    exit(EXIT_FAILURE);
+  }
+  close(to_db[0]);
+  close(from_db[1]);
+
+  pid_t generator = fork();
+  check(generator, "forking generator");
+  if (generator == 0) {
+    close(from_db[0]);
+    generate(to_db[1]);
+    exit(EXIT_SUCCESS);
+  }
+  close(to_db[1]);
+
+  FILE* in = fdopen(from_db[0], "r");
+  char line[LINE_SIZE];
+  while (fgets(line, sizeof(line), in)) {
+    parse_line(line);
+  }
+  fclose(in);
+
+  int status;
+  struct rusage usage;
+  check(wait4(db, &status, 0, &usage), "waiting for myjql");
+  double seconds = now_seconds() - start;
+  int generator_status;
+  check(waitpid(generator, &generator_status, 0), "waiting for generator");
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !result.seen_stats) {
+    printf("Error: %s did not finish the workload\n", options.bin);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat st;
+  uint64_t file_bytes = stat(options.db, &st) == 0 ? (uint64_t)st.st_size : 0;
+  unlink(options.db);
+
+  printf("{\"label\":");
+  print_json_string(options.label);
+  printf(",\"ops\":%" PRIu64 ",\"mix\":[%u,%u,%u],\"dist\":\"%s\",", options.ops,
+         options.mix[0], options.mix[1], options.mix[2], dist_names[options.dist]);
+  if (options.dist == DIST_ZIPF) {
+    printf("\"theta\":%g,", options.theta);
+  }
+  printf("\"keys\":%" PRIu64 ",\"seed\":%" PRIu64 ",\"args\":\"", options.keys, options.seed);
+  for (uint32_t i = 0; i < options.num_passed; ++i) {
+    if (i) {
+      putchar(' ');
+    }
+    print_json_chars(options.passed[i]);
+  }
+  printf("\",\"seconds\":%.6f,\"ops_per_sec\":%.0f,", seconds, options.ops / seconds);
+  for (uint32_t i = 0; i < 3; ++i) {
+    Latency* l = &result.latency[i];
+    printf("\"%s\":{\"count\":%" PRIu64 ",\"mean_ns\":%" PRIu64 ",\"p50_ns\":%" PRIu64 ",\"p90_ns\":%" PRIu64 ","
+           "\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "},",
+           statement_names[i], l->count, l->mean, l->p50, l->p90, l->p99, l->p999, l->max);
+  }
+  printf("\"file_bytes\":%" PRIu64 ",\"max_rss_kb\":%ld,\"page_reads\":%" PRIu64 ",\"page_writes\":%" PRIu64 ","
+         "\"cache_hits\":%" PRIu64 ",\"cache_misses\":%" PRIu64 ",\"leaf_splits\":%" PRIu64 ","
+         "\"internal_splits\":%" PRIu64 ",\"merges\":%" PRIu64 ",\"redistributions\":%" PRIu64 ",\"height\":%u}\n", file_bytes, usage.ru_maxrss, result.page_reads,
+         result.page_writes, result.cache_hits, result.cache_misses, result.leaf_splits, result.internal_splits,
+         result.merges, result.redistributions, result.height);
+}
+
+/*---------------------------------------------*/
+
+void usage_error (const char* arg) {
+  printf("Unrecognized option '%s'.\n", arg);
+  exit(EXIT_FAILURE);
+}
+
+int main (int argc, char* argv[]) {
+  int i = 1;
+  for (; i < argc; ++i) {
+    char* arg = argv[i];
+    if (strcmp(arg, "--") == 0) {
+      ++i;
+      break;
+    } else if (strncmp(arg, "--ops=", 6) == 0) {
+      options.ops = strtoull(arg + 6, NULL, 10);
+    } else if (strncmp(arg, "--mix=", 6) == 0) {
+      if (sscanf(arg + 6, "%u:%u:%u", &options.mix[0], &options.mix[1], &options.mix[2]) != 3
+          || options.mix[0] + options.mix[1] + options.mix[2] == 0) {
+        usage_error(arg);
+      }
+    } else if (strncmp(arg, "--dist=", 7) == 0) {
+      uint32_t d = 0;
+      while (d < 3 && strcmp(arg + 7, dist_names[d]) != 0) {
+        ++d;
+      }
+      if (d == 3) {
+        usage_error(arg);
+      }
+      options.dist = (Distribution)d;
+    } else if (strncmp(arg, "--theta=", 8) == 0) {
+      options.theta = atof(arg + 8);
+      if (options.theta <= 0 || options.theta >= 1) {
+        usage_error(arg);
+      }
+    } else if (strncmp(arg, "--dup=", 6) == 0) {
+      options.dup = strtoul(arg + 6, NULL, 10);
+      if (options.dup == 0) {
+        usage_error(arg);
+      }
+    } else if (strncmp(arg, "--keys=", 7) == 0) {
+      options.keys = strtoull(arg + 7, NULL, 10);
+    } else if (strncmp(arg, "--seed=", 7) == 0) {
+      options.seed = strtoull(arg + 7, NULL, 10);
+    } else if (strncmp(arg, "--bin=", 6) == 0) {
+      options.bin = arg + 6;
+    } else if (strncmp(arg, "--db=", 5) == 0) {
+      options.db = arg + 5;
+    } else if (strncmp(arg, "--label=", 8) == 0) {
+      options.label = arg + 8;
+    } else if (strncmp(arg, "--workload=", 11) == 0) {
+      options.workload = arg + 11;
+    } else {
+      usage_error(arg);
+    }
+  }
+  for (; i < argc && options.num_passed < MAX_PASSED_ARGS; ++i) {
+    options.passed[options.num_passed++] = argv[i];
+  }
+
+  if (options.keys == 0) {
+    // enough distinct b for the inserts to land dup rows on each
+    uint64_t inserts = options.ops * options.mix[0] / (options.mix[0] + options.mix[1] + options.mix[2]);
+    options.keys = inserts / options.dup ? inserts / options.dup : 1;
+  }
+  if (options.dist == DIST_ZIPF) {
+    zipf_init(options.keys, options.theta);
+  }
+
+  if (options.workload) {
+    int fd = strcmp(options.workload, "-") == 0 ? dup(STDOUT_FILENO)
+                                                 : open(options.workload, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check(fd, "opening workload");
+    generate(fd);
+    return 0;
+  }
+  run();
+  return 0;
+}
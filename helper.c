@@ -32,7 +32,30 @@ int main () {
         ssize_t bytes_read = read(fd, page, PAGE_SIZE);
 
         uint8_t node_type = *((uint8_t*)(page));
-        if (node_type == 0) {
+        if (i == 0) {
+            printf("Page [0] Is the Header Page\n");
+            printf("- Magic is [%08x], Version %d\n", *((uint32_t*)(page)), *((uint32_t*)(page + 4)));
+            printf("- Page Size is %d\n", *((uint32_t*)(page + 8)));
+            printf("- Root Page is [%d]\n", *((uint32_t*)(page + 12)));
+            printf("- Having %d Pages\n", *((uint32_t*)(page + 16)));
+            printf("- Free List Head is [%d]\n", *((uint32_t*)(page + 20)));
+            printf("- Having %lu Rows\n", *((uint64_t*)(page + 24)));
+            printf("- Index on a Root Page is [%d]\n", *((uint32_t*)(page + 32)));
+        }
+        else if (node_type == 2) {
+            printf("Page [%d] Is a Free Page\n", i);
+            printf("- Next Free Page is [%d]\n", *((uint32_t*)(page + 2)));
+        }
+        else if (node_type == 3) {
+            printf("Page [%d] Is an Overflow Page\n", i);
+            printf("- Next Overflow Page is [%d]\n", *((uint32_t*)(page + 2)));
+            uint32_t num_values = *((uint32_t*)(page + 6));
+            printf("- Having %d Values\n", num_values);
+            for (int32_t i = 0; i < num_values; ++i) {
+                printf("Value [%d]\n", *((uint32_t*)(page + 10 + i * 4)));
+            }
+        }
+        else if (node_type == 0) {
             printf("Page [%d] Is an Internal Page", i);
             uint8_t is_root = *((uint8_t*)(page + 1));
             if (is_root == 1) {
@@ -42,37 +65,50 @@ int main () {
                 printf("\n");
             }
 
-            uint32_t parent_id = *((uint32_t*)(page + 2));
-            printf("- Parent ID is [%d]\n", parent_id);
-
-            uint32_t num_keys = *((uint32_t*)(page + 6));
+            uint32_t num_keys = *((uint32_t*)(page + 2));
             printf("- Having %d Keys\n", num_keys);
 
-            uint32_t rightmost_child_id = *((uint32_t*)(page + 10));
+            uint32_t rightmost_child_id = *((uint32_t*)(page + 6));
             printf("-- Rightmost Child is: %d\n", rightmost_child_id);
 
-            void* cell_start = (void*)page + 14;
+            uint16_t prefix_length = *((uint16_t*)(page + 10));
+            uint16_t suffix_size = *((uint16_t*)(page + 12));
+            printf("-- Prefix [%.*s], Suffix Size is %d\n", prefix_length, (char*)(page + 14), suffix_size);
+
+            void* cell_start = (void*)page + 26;
             for (int i = 0; i < num_keys; ++i) {
-                printf("--- Child id [%d]", *((uint32_t*)(cell_start + i * 16)) );
-                printf("--- Key [%d]: %s", i, ((char*)(cell_start + i * 16 + 4)) );
+                void* cell = cell_start + i * (4 + suffix_size);
+                printf("--- Child id [%d]", *((uint32_t*)(cell)) );
+                printf("--- Key [%d]: %.*s%.*s", i, prefix_length, (char*)(page + 14), suffix_size, (char*)(cell + 4) );
                 printf("\n");
             }
         }
         else {
             printf("Page %d, Is a leaf page\n", i);
 
-            uint32_t parent_id = *((uint32_t*)(page + 2));
-            printf("- Parent ID is [%d]\n", parent_id);
-
-            uint32_t num_cells = *((uint32_t*)(page + 6));
+            uint32_t num_cells = *((uint32_t*)(page + 2));
             printf("- Having %d Cells\n", num_cells);
             
-            uint32_t next_leaf_id = *((uint32_t*)(page + 10));
+            uint32_t next_leaf_id = *((uint32_t*)(page + 6));
             printf("- Next Leaf's Page Id is: [%d]\n", next_leaf_id);
+            printf("- Heap Starts at: %d\n", *((uint32_t*)(page + 10)));
+            uint16_t prefix_length = *((uint16_t*)(page + 14));
+            uint16_t suffix_size = 12 - prefix_length;
+            printf("- Prefix [%.*s]\n", prefix_length, (char*)(page + 16));
             for (int32_t i = 0; i < num_cells; ++i) {
-                void* start = (void*)(page + 14 + i * 16);
-                printf("Key [%s]\t", (char*)(start));
-                printf("Value [%d]\n", *((int*)(start + 12)));
+                uint16_t slot = *((uint16_t*)(page + 28 + i * 2));
+                void* start = (void*)(page + slot);
+                uint16_t count = *((uint16_t*)(start + suffix_size));
+                printf("Slot [%d] Key [%.*s%.*s]\t", slot, prefix_length, (char*)(page + 16), suffix_size, (char*)(start));
+                if (count == 0xffff) {
+                    printf("Overflow Page [%d]\n", *((uint32_t*)(start + suffix_size + 2)));
+                    continue;
+                }
+                printf("Values");
+                for (int32_t j = 0; j < count; ++j) {
+                    printf(" [%d]", *((uint32_t*)(start + suffix_size + 2 + j * 4)));
+                }
+                printf("\n");
             }
         }
 
@@ -0,0 +1,309 @@
+/* Microbenchmarks for the B+ tree node kernels of myjql */
+/* Compile: gcc -o microbench microbench.c -O2 */
+/* Run: ./microbench [iterations] */
+
+/* the kernels run straight on pages in memory, no pager, no file: myjql.c is compiled in with
+ * its main renamed. searches run on full nodes, splits on a full leaf, merges on two nodes
+ * filled 2/5 and redistributions on one filled 9/10 next to one filled 3/10.
+ * kernels that change their pages get fresh copies every time, the time of the copies alone
+ * is measured as well and taken off. cycles come from perf_event_open if the kernel allows it */
+
+#define main myjql_main
+#include "myjql.c"
+#undef main
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define NUM_KEYS (1 << 16) // sorted random keys the nodes are filled from
+#define NUM_PROBES 1024 // keys searched for, half of them are in the node
+#define DEFAULT_ITERATIONS 200000
+
+char keys[NUM_KEYS][12];
+char probes[NUM_PROBES][12];
+uint64_t rng_state = 1;
+
+uint64_t rng_next () {
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+int compare_keys (const void* a, const void* b) {
+  return memcmp(a, b, 12);
+}
+
+// b values of 11 random lowercase letters, sorted and without duplicates
+void make_keys () {
+  for (uint32_t i = 0; i < NUM_KEYS; ++i) {
+    for (uint32_t j = 0; j < 11; ++j) {
+      keys[i][j] = 'a' + rng_next() % 26;
+    }
+    keys[i][11] = '\0';
+  }
+  qsort(keys, NUM_KEYS, 12, compare_keys);
+  uint32_t unique = 1;
+  for (uint32_t i = 1; i < NUM_KEYS; ++i) {
+    if (memcmp(keys[i], keys[unique - 1], 12) != 0) {
+      memcpy(keys[unique++], keys[i], 12);
+    }
+  }
+  for (; unique < NUM_KEYS; ++unique) {
+    memcpy(keys[unique], keys[unique - 1], 12);
+    keys[unique][10] += 1; // practically never needed
+  }
+}
+
+/*---------- Node Builders --------------*/
+
+// number of keys from first on that fit in one leaf with one value each
+uint32_t leaf_capacity (uint32_t first) {
+  uint32_t n = 1;
+  while (first + n < NUM_KEYS) {
+    uint32_t suffix_size = LEAF_NODE_KEY_SIZE - key_common_prefix(keys[first], keys[first + n], LEAF_NODE_KEY_SIZE);
+    if ((n + 1) * leaf_cell_size(suffix_size, 1) > LEAF_NODE_SPACE_FOR_CELLS) {
+      break;
+    }
+    ++n;
+  }
+  return n;
+}
+
+// leaf holding keys[first, first + n), the value of each is its index
+void build_leaf (void* node, uint32_t first, uint32_t n) {
+  initialize_leaf_node(node);
+  leaf_node_set_prefix(node, keys[first], key_common_prefix(keys[first], keys[first + n - 1], LEAF_NODE_KEY_SIZE));
+  for (uint32_t i = first; i < first + n; ++i) {
+    leaf_node_append_cell(node, keys[i], 1, &i);
+  }
+}
+
+// separators of an internal node are cut short like key_separator does between two leaves
+void make_separator (uint32_t i, char* separator) {
+  key_separator(keys[i * 8], keys[i * 8 + 1], separator);
+}
+
+uint32_t internal_capacity (uint32_t first) {
+  char separators[INTERNAL_NODE_MAX_KEYS + 1][12];
+  uint32_t n = 0;
+  while (n < INTERNAL_NODE_MAX_KEYS && (first + n + 1) * 8 < NUM_KEYS) {
+    make_separator(first + n, separators[n]);
+    if (internal_node_packed_bytes(separators, n + 1) > INTERNAL_NODE_SPACE_FOR_CELLS) {
+      break;
+    }
+    ++n;
+  }
+  return n;
+}
+
+// internal node with separators first to first + n, children are numbered along
+void build_internal (void* node, uint32_t first, uint32_t n) {
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 1];
+  char separators[INTERNAL_NODE_MAX_KEYS][12];
+  for (uint32_t i = 0; i < n; ++i) {
+    make_separator(first + i, separators[i]);
+    children[i] = first + i + 1;
+  }
+  children[n] = first + n + 1;
+  initialize_internal_node(node);
+  internal_node_pack(node, children, separators, n);
+}
+
+/*---------- Timing --------------*/
+
+int cycles_fd = -1;
+
+void cycles_open () {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+typedef struct {
+  double ns;
+  double cycles; // < 0 without perf_event_open
+} Sample;
+
+typedef void (*Kernel)(uint32_t i);
+
+Sample measure (Kernel kernel, uint32_t iterations) {
+  kernel(0); // warm up the caches
+  struct timespec start, end;
+  uint64_t cycles = 0;
+  if (cycles_fd >= 0) {
+    ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < iterations; ++i) {
+    kernel(i);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (cycles_fd >= 0) {
+    ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+      cycles = 0;
+    }
+  }
+  Sample sample;
+  sample.ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+  sample.cycles = cycles_fd >= 0 ? (double)cycles / iterations : -1;
+  return sample;
+}
+
+/*---------- Kernels --------------*/
+
+// PAGE_SIZE is not a constant expression, the pages are allocated in main
+char* leaf_full;
+char* internal_full;
+char* leaf_left, * leaf_right; // for merges
+char* leaf_heavy, * leaf_light; // for redistributions
+char* internal_left, * internal_right;
+char* internal_heavy, * internal_light;
+char internal_separator[12], heavy_separator[12];
+
+char* work_left, * work_right;
+char work_separator[12];
+volatile uint32_t sink;
+
+void run_leaf_find (uint32_t i) {
+  sink = leaf_node_find_key_index(leaf_full, probes[i % NUM_PROBES]);
+}
+
+void run_internal_find (uint32_t i) {
+  sink = internal_node_find_child(internal_full, probes[i % NUM_PROBES]);
+}
+
+void copy_pair (void* left, void* right) {
+  memcpy(work_left, left, PAGE_SIZE);
+  memcpy(work_right, right, PAGE_SIZE);
+}
+
+void run_copy (uint32_t i) {
+  copy_pair(leaf_full, leaf_right);
+  sink = work_left[i % PAGE_SIZE];
+}
+
+// what leaf_node_split does to the pages: a full leaf shares its cells with a new one
+void run_leaf_split (uint32_t i) {
+  (void)i;
+  copy_pair(leaf_full, leaf_right);
+  initialize_leaf_node(work_right);
+  uint32_t left_cells = leaf_node_even_split(work_left, work_right);
+  leaf_node_repack(work_left, work_right, left_cells);
+  sink = left_cells;
+}
+
+void run_leaf_redistribute (uint32_t i) {
+  (void)i;
+  copy_pair(leaf_heavy, leaf_light);
+  leaf_redistribute(work_left, work_right, work_separator);
+  sink = work_separator[0];
+}
+
+void run_leaf_merge (uint32_t i) {
+  (void)i;
+  copy_pair(leaf_left, leaf_right);
+  leafnode_merge(work_left, work_right);
+  sink = *leaf_node_num_cells(work_left);
+}
+
+void run_internal_redistribute (uint32_t i) {
+  (void)i;
+  copy_pair(internal_heavy, internal_light);
+  memcpy(work_separator, heavy_separator, 12);
+  internalnode_redistribute(work_left, work_right, work_separator);
+  sink = work_separator[0];
+}
+
+void run_internal_merge (uint32_t i) {
+  (void)i;
+  copy_pair(internal_left, internal_right);
+  memcpy(work_separator, internal_separator, 12);
+  internalnode_merge(work_left, work_right, work_separator);
+  sink = *internal_node_num_keys(work_left);
+}
+
+typedef struct {
+  const char* name;
+  Kernel kernel;
+  bool copies; // works on fresh copies of two pages
+  uint32_t scale; // searches are cheap, they run this many times more often
+} Benchmark;
+
+Benchmark benchmarks[] = {
+  {"leaf_node_find_key_index", run_leaf_find, false, 20},
+  {"internal_node_find_child", run_internal_find, false, 20},
+  {"leaf_split", run_leaf_split, true, 1},
+  {"leaf_redistribute", run_leaf_redistribute, true, 1},
+  {"leafnode_merge", run_leaf_merge, true, 1},
+  {"internalnode_redistribute", run_internal_redistribute, true, 1},
+  {"internalnode_merge", run_internal_merge, true, 1},
+};
+
+/*---------------------------------------------*/
+
+int main (int argc, char* argv[]) {
+  uint32_t iterations = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  make_keys();
+  char** pages[] = {&leaf_full, &internal_full, &leaf_left, &leaf_right, &leaf_heavy, &leaf_light,
+                    &internal_left, &internal_right, &internal_heavy, &internal_light, &work_left, &work_right};
+  for (uint32_t i = 0; i < sizeof(pages) / sizeof(pages[0]); ++i) {
+    *pages[i] = calloc(1, PAGE_SIZE);
+  }
+
+  uint32_t leaf_cells = leaf_capacity(0);
+  build_leaf(leaf_full, 0, leaf_cells);
+  uint32_t part = leaf_cells * 2 / 5;
+  build_leaf(leaf_left, 0, part);
+  build_leaf(leaf_right, part, part);
+  build_leaf(leaf_heavy, 0, leaf_cells * 9 / 10);
+  build_leaf(leaf_light, leaf_cells * 9 / 10, leaf_cells * 3 / 10);
+
+  uint32_t internal_keys = internal_capacity(0);
+  build_internal(internal_full, 0, internal_keys);
+  part = internal_keys * 2 / 5;
+  build_internal(internal_left, 0, part);
+  make_separator(part, internal_separator);
+  build_internal(internal_right, part + 1, part);
+  uint32_t heavy = internal_keys * 9 / 10;
+  build_internal(internal_heavy, 0, heavy);
+  make_separator(heavy, heavy_separator);
+  build_internal(internal_light, heavy + 1, internal_keys * 3 / 10);
+
+  // every other probe is a key of the full leaf, the rest fall between the separators
+  for (uint32_t i = 0; i < NUM_PROBES; ++i) {
+    uint32_t k = (i % 2 == 0) ? rng_next() % leaf_cells : rng_next() % ((internal_keys + 1) * 8);
+    memcpy(probes[i], keys[k], 12);
+  }
+
+  cycles_open();
+  printf("PAGE_SIZE %u, full leaf %u cells, full internal node %u keys, cycles %s\n", PAGE_SIZE,
+         leaf_cells, internal_keys, cycles_fd >= 0 ? "from perf_event_open" : "not available");
+  printf("%-26s %10s %10s\n", "kernel", "ns/op", "cycles/op");
+
+  Sample copy = measure(run_copy, iterations);
+  for (uint32_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); ++b) {
+    Sample sample = measure(benchmarks[b].kernel, iterations * benchmarks[b].scale);
+    if (benchmarks[b].copies) {
+      sample.ns -= copy.ns;
+      sample.cycles -= cycles_fd >= 0 ? copy.cycles : 0;
+    }
+    if (sample.cycles >= 0) {
+      printf("%-26s %10.1f %10.1f\n", benchmarks[b].name, sample.ns, sample.cycles);
+    }
+    else {
+      printf("%-26s %10.1f %10s\n", benchmarks[b].name, sample.ns, "-");
+    }
+  }
+  printf("(two page copies, taken off above: %.1f ns)\n", copy.ns);
+  return 0;
+}
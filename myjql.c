@@ -2,8 +2,19 @@
 /* Compile: gcc -o myjql myjql.c -O3 */
 /* Test: /usr/bin/time -v ./myjql myjql.db < in.txt > out.txt */
 /* Compare: diff out.txt ans.txt */
+/* Options: --frames=N  size of the buffer pool in 4KB frames (default 1024)
+            --mmap      map the db file instead of using the buffer pool
+            --batch     no prompts or `Executed.` banners, only the rows selected
+            --stats     print the `.stats` report when the db is closed
+            --no-wal    no write-ahead log, the db file is only written when it is closed
+            --wal-batch=N      sync the log at the latest after N statements (default 1000)
+            --wal-interval=MS  or once the oldest unsynced statement is MS old (default 100, 0: never),
+                               checked as statements finish, the log is synced before waiting for input anyway
+            with --mmap the pages are written in place and there is no log. a log left behind
+            by a crash has to be recovered by an open with the log first */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,18 +24,46 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 
 /* shell IO */
 
 #define INPUT_BUFFER_SIZE 31
-#define TABLE_MAX_PAGES 65536
+#define INPUT_BLOCK_SIZE (1 << 16) // bytes read from stdin at once
+#define OUTPUT_BUFFER_SIZE (1 << 20) // stdout buffer when stdin is not a terminal
+#define INVALID_PAGE_ID UINT32_MAX // frame holds no page yet
+#define DEFAULT_POOL_FRAMES 1024 // 4MB buffer pool, override with --frames=N
+#define MMAP_RESERVE (1ULL << 36) // 64GB of address space reserved in mmap mode
+#define MMAP_MIN_EXTENT (16 << 20) // mmap mode grows the file by at least 16MB
+#define FLUSH_MAX_IOV 256 // pages written by one pwritev, 1MB
+#define MAX_TREE_DEPTH 16 // internal levels a cursor can remember on its way down
 #define ROW_SIZE 16
+#define WAL_BUFFER_SIZE (1 << 16) // log records collected before they are written
+#define DEFAULT_WAL_BATCH 1000 // statements one sync of the log covers at most
+#define DEFAULT_WAL_INTERVAL_MS 100 // age of the oldest statement that forces a sync
+#define CHECKPOINT_SPILL_PAGES 16384 // 64MB of spilled pages trigger a checkpoint
+#define CHECKPOINT_WAL_BYTES (64 << 20) // so does a log this long
 
 struct {
   char buffer[INPUT_BUFFER_SIZE + 1];
   size_t length;
 } input_buffer;
 
+/* stdin is read in blocks, read_input takes the lines out of them */
+struct {
+  char data[INPUT_BLOCK_SIZE];
+  size_t length;
+  size_t position;
+} input_block;
+
+bool batch_mode = false; // --batch: the shell prints nothing but the rows
+/* set on the ways out of the shell (end of input, .exit, ctrl-c). any other exit is an error
+ * the tree may be broken at, the db is not closed then and the log stays for the next open */
+bool clean_exit = false;
+
 typedef enum {
   INPUT_SUCCESS,
   INPUT_TOO_LONG
@@ -33,299 +72,1461 @@ typedef enum {
 /* pager and table */
 const uint32_t PAGE_SIZE = 4096; // 4KB page
 
-// typedef struct ListNode {
-//   struct ListNode* prev;
-//   struct ListNode* next;
-//   uint32_t free_page_id;
-// } ListNode_t;
-
-// typedef struct FreeList {
-//   ListNode_t* head;
-//   ListNode_t* tail;
-//   int32_t size;
-// } FreeList_t;
+uint32_t pool_frames = DEFAULT_POOL_FRAMES; // number of frames in the buffer pool
+bool use_mmap = false; // map the whole file instead of going through the pool
+bool stats_at_close = false; // --stats: print the statistics from db_close
+bool use_wal = true; // --no-wal turns the write-ahead log off
+uint32_t wal_batch = DEFAULT_WAL_BATCH;
+uint32_t wal_interval_ms = DEFAULT_WAL_INTERVAL_MS;
 
+/* counters behind `.stats`, bumped where the events happen */
+struct {
+  uint64_t page_reads; // pages read from the file into the pool
+  uint64_t page_writes; // pages written back from the pool
+  uint64_t cache_hits; // get_page found the page in the pool
+  uint64_t cache_misses; // get_page had to take a frame for it
+  uint64_t leaf_splits;
+  uint64_t internal_splits;
+  uint64_t merges; // nodes merged into their sibling
+  uint64_t redistributions; // nodes that took from or gave to their sibling
+  uint64_t wal_syncs; // fdatasync of the log, each commits a group of statements
+  uint64_t checkpoints;
+  uint64_t page_spills; // dirty pages evicted to the spill file
+} stats;
+
+/* struct listnode for LRU cache */
+typedef struct ListNode {
+  int32_t frame_id;
+  struct ListNode* next;
+  struct ListNode* prev;
+} ListNode_t;
+
+/* LRU replacer, holds every frame whose pin count dropped to zero */
+typedef struct LRU {
+  int32_t capacity;
+  int32_t size;
+  ListNode_t head;
+  ListNode_t tail;
+  ListNode_t* nodes; // one node per frame, no malloc on pin/unpin
+  ListNode_t** hash_table; // frame_id => node, NULL if frame is not evictable
+} LRU_cache;
+
+/* frames that never held a page yet */
+typedef struct FreeList {
+  int32_t* frame_ids;
+  uint32_t size;
+} FreeList_t;
+
+typedef struct Page {
+  void* content;
+  bool is_dirty;
+  int16_t pin_count;
+  uint32_t page_id;
+  int32_t hash_next; // next frame in the same page table bucket, -1 ends the chain
+} Page_t;
+
+/* A simple buffer pool manager */
 typedef struct {
   int file_descriptor;
-  uint32_t file_length;
+  off_t file_length;
   uint32_t num_pages;
-  void* pages[TABLE_MAX_PAGES];
+  uint32_t free_head; // first page of the free page list, saved in the header page
+
+  uint32_t num_frames;
+  Page_t* frames_; // fixed-size pool of frames
+
+  /* page table: page_id => frame_id, chained hash over resident pages only,
+     so its size follows the pool rather than the file */
+  int32_t* page_table_; // bucket heads, -1 if empty
+  uint32_t page_table_mask_; // number of buckets - 1
+
+  LRU_cache* replacer_;
+  FreeList_t* freelist_;
+
+  void* map_; // mmap mode only: base of the mapping, NULL in buffer pool mode
+
+  /* with the write-ahead log the db file only changes at checkpoints,
+     dirty pages evicted in between go to the spill file */
+  int spill_fd; // -1 without the log
+  uint32_t* spill_slots; // page_id => 1 + slot in the spill file, 0 if the page was not spilled
+  uint32_t spill_capacity; // entries of spill_slots
+  uint32_t num_spilled;
 } Pager;
 
+/* a B+ tree in the db file, the table itself or an index on it. all of them share the pager */
 typedef struct {
   Pager* pager;
-  uint32_t root_page_num;
+  uint32_t root_page_num; // moves when the root splits or collapses, saved in the header page
+  uint64_t num_rows;
+
+  struct Cursor* append_hint; // path to the rightmost leaf, see table_find_append
+  bool append_hint_valid;
 } Table;
 
 Table* table; // global variable, entry of the whole table
+Table* index_a; // secondary index on column a, NULL if the db has none
+
+/* ------------------------------------------------------------------------ */
+
+LRU_cache* LRUCacheInit (int32_t capacity) {
+  LRU_cache* cache = malloc(sizeof(LRU_cache));
+  cache->capacity = capacity;
+  cache->size = 0;
+  cache->nodes = malloc(sizeof(ListNode_t) * capacity);
+  cache->hash_table = malloc(sizeof(ListNode_t*) * capacity);
+  cache->head.prev = NULL;
+  cache->tail.next = NULL;
+  cache->head.next = &cache->tail;
+  cache->tail.prev = &cache->head;
+  for (int32_t i = 0; i < capacity; ++i) {
+    cache->nodes[i].frame_id = i;
+    cache->hash_table[i] = NULL;
+  }
+  return cache;
+}
+
+void put_node_to_last (LRU_cache* obj, ListNode_t* node) {
+  ListNode_t* prev = obj->tail.prev;
+  ListNode_t* next = &obj->tail;
+  prev->next = node;
+  node->prev = prev;
+  node->next = next;
+  next->prev = node;
+}
+
+void take_node_from_middle (ListNode_t* node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+}
+
+void delete (LRU_cache* obj, const int32_t frame_id) {
+  ListNode_t* node = obj->hash_table[frame_id];
+  if (!node) {
+    return;
+  }
+  take_node_from_middle(node);
+  obj->size--;
+  obj->hash_table[frame_id] = NULL;
+}
+
+void LRUCachePut (LRU_cache* obj, int32_t frame_id) {
+  ListNode_t* node = &obj->nodes[frame_id];
+  obj->hash_table[frame_id] = node;
+  put_node_to_last(obj, node);
+  obj->size++;
+}
+
+void LRUCacheFree (LRU_cache* obj) {
+  free(obj->nodes);
+  free(obj->hash_table);
+  free(obj);
+}
+
+/* return the least recently unpinned frame, and take it out of the replacer */
+bool Victim (LRU_cache* obj, int32_t* frame_id) {
+  if (!obj->size) {
+    return false;
+  }
+
+  ListNode_t* node = obj->head.next;
+  *frame_id = node->frame_id;
+  delete(obj, node->frame_id);
+  return true;
+}
+
+/* Pinned frames must not be chosen as victims */
+void Pin (LRU_cache* obj, int32_t frame_id) {
+  delete(obj, frame_id);
+}
+
+/* Add frame_id into Replacer, showing that it could be replaced */
+void UnPin (LRU_cache* obj, int32_t frame_id) {
+  if (!obj->hash_table[frame_id]) {
+    LRUCachePut(obj, frame_id);
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+
+FreeList_t* FreeListInit (uint32_t num_frames) {
+  FreeList_t* freelist_ = malloc(sizeof(FreeList_t));
+  freelist_->frame_ids = malloc(sizeof(int32_t) * num_frames);
+  freelist_->size = 0;
+  // hand out low frame ids first
+  for (int32_t i = num_frames - 1; i >= 0; --i) {
+    freelist_->frame_ids[freelist_->size++] = i;
+  }
+  return freelist_;
+}
+
+bool is_empty (FreeList_t* freelist_) {
+  return (freelist_->size == 0);
+}
+
+int32_t pop_back (FreeList_t* freelist_) {
+  // always assume that freelist is not empty
+  return freelist_->frame_ids[--freelist_->size];
+}
+
+void FreeListFree (FreeList_t* freelist_) {
+  free(freelist_->frame_ids);
+  free(freelist_);
+}
+
+/* ------------------------------------------------------------------------ */
+
+uint32_t page_table_bucket (Pager* pager, uint32_t page_num) {
+  return (page_num * 2654435761u) & pager->page_table_mask_; // Fibonacci hashing
+}
+
+// return frame_id of a resident page, -1 if not in the pool
+int32_t page_table_lookup (Pager* pager, uint32_t page_num) {
+  int32_t frame_id = pager->page_table_[page_table_bucket(pager, page_num)];
+  while (frame_id != -1 && pager->frames_[frame_id].page_id != page_num) {
+    frame_id = pager->frames_[frame_id].hash_next;
+  }
+  return frame_id;
+}
+
+void page_table_insert (Pager* pager, uint32_t page_num, int32_t frame_id) {
+  uint32_t bucket = page_table_bucket(pager, page_num);
+  pager->frames_[frame_id].page_id = page_num;
+  pager->frames_[frame_id].hash_next = pager->page_table_[bucket];
+  pager->page_table_[bucket] = frame_id;
+}
+
+void page_table_remove (Pager* pager, uint32_t page_num) {
+  int32_t* link = &pager->page_table_[page_table_bucket(pager, page_num)];
+  while (*link != -1) {
+    Page_t* frame = &pager->frames_[*link];
+    if (frame->page_id == page_num) {
+      *link = frame->hash_next;
+      frame->hash_next = -1;
+      frame->page_id = INVALID_PAGE_ID;
+      return;
+    }
+    link = &frame->hash_next;
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+
+// write back the page, only with complete pages
+void pager_flush(Pager* pager, uint32_t page_num) {
+  int32_t frame_id = page_table_lookup(pager, page_num);
+  if (frame_id == -1) {
+     printf("Tried to flush null page\n");
+     exit(EXIT_FAILURE);
+  }
+
+  off_t offset = (off_t)page_num * PAGE_SIZE;
+  ssize_t bytes_written = pwrite(pager->file_descriptor, pager->frames_[frame_id].content, PAGE_SIZE, offset);
+  // printf("Had Written: %ld\n", bytes_written);
+  if (bytes_written != PAGE_SIZE) {
+     printf("Error writing: %d\n", errno);
+     exit(EXIT_FAILURE);
+  }
+
+  pager->frames_[frame_id].is_dirty = false;
+  stats.page_writes += 1;
+  if (offset + PAGE_SIZE > pager->file_length) {
+    pager->file_length = offset + PAGE_SIZE;
+  }
+}
+
+/* write back `count` frames that hold the consecutive pages first_page, first_page + 1, ... */
+void pager_flush_run (Pager* pager, uint32_t first_page, uint64_t* run, uint32_t count) {
+  struct iovec iov[FLUSH_MAX_IOV];
+  off_t offset = (off_t)first_page * PAGE_SIZE;
+
+  while (count > 0) {
+    uint32_t batch = count < FLUSH_MAX_IOV ? count : FLUSH_MAX_IOV;
+    for (uint32_t i = 0; i < batch; ++i) {
+      Page_t* frame = &pager->frames_[(int32_t)run[i]];
+      iov[i].iov_base = frame->content;
+      iov[i].iov_len = PAGE_SIZE;
+      frame->is_dirty = false;
+    }
+
+    // pwritev may stop short, resume from the first unwritten byte
+    struct iovec* next = iov;
+    int left = batch;
+    off_t pos = offset;
+    while (left > 0) {
+      ssize_t bytes_written = pwritev(pager->file_descriptor, next, left, pos);
+      if (bytes_written <= 0) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      pos += bytes_written;
+      while (left > 0 && (size_t)bytes_written >= next->iov_len) {
+        bytes_written -= next->iov_len;
+        ++next;
+        --left;
+      }
+      if (left > 0) {
+        next->iov_base += bytes_written;
+        next->iov_len -= bytes_written;
+      }
+    }
+
+    offset += (off_t)batch * PAGE_SIZE;
+    run += batch;
+    count -= batch;
+    stats.page_writes += batch;
+  }
+
+  if (offset > pager->file_length) {
+    pager->file_length = offset;
+  }
+}
+
+int compare_flush_entry (const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/* write back every dirty frame, sorted by page id so adjacent pages go out in one pwritev */
+void pager_flush_all (Pager* pager) {
+  // entry = page_id << 32 | frame_id, sorting entries sorts by page id
+  uint64_t* dirty = malloc(sizeof(uint64_t) * pager->num_frames);
+  uint32_t num_dirty = 0;
+  for (uint32_t i = 0; i < pager->num_frames; ++i) {
+    Page_t* frame = &pager->frames_[i];
+    if (frame->page_id != INVALID_PAGE_ID && frame->is_dirty) {
+      dirty[num_dirty++] = ((uint64_t)frame->page_id << 32) | i;
+    }
+  }
+  qsort(dirty, num_dirty, sizeof(uint64_t), compare_flush_entry);
+
+  uint32_t start = 0;
+  while (start < num_dirty) {
+    uint32_t first_page = dirty[start] >> 32;
+    uint32_t end = start + 1;
+    while (end < num_dirty && (dirty[end] >> 32) == first_page + (end - start)) {
+      ++end;
+    }
+    pager_flush_run(pager, first_page, dirty + start, end - start);
+    start = end;
+  }
+  free(dirty);
+}
+
+// 1 + slot of a spilled page in the spill file, 0 if page_num is not there
+uint32_t pager_spill_slot (Pager* pager, uint32_t page_num) {
+  return page_num < pager->spill_capacity ? pager->spill_slots[page_num] : 0;
+}
+
+// write a dirty frame that is evicted to the spill file instead of the db file
+void pager_spill (Pager* pager, Page_t* frame) {
+  uint32_t page_num = frame->page_id;
+  if (page_num >= pager->spill_capacity) {
+    uint32_t capacity = pager->spill_capacity ? pager->spill_capacity : 1024;
+    while (capacity <= page_num) {
+      capacity *= 2;
+    }
+    pager->spill_slots = realloc(pager->spill_slots, sizeof(uint32_t) * capacity);
+    memset(pager->spill_slots + pager->spill_capacity, 0, sizeof(uint32_t) * (capacity - pager->spill_capacity));
+    pager->spill_capacity = capacity;
+  }
+  if (pager->spill_slots[page_num] == 0) {
+    pager->spill_slots[page_num] = ++pager->num_spilled;
+  }
+
+  off_t offset = (off_t)(pager->spill_slots[page_num] - 1) * PAGE_SIZE;
+  if (pwrite(pager->spill_fd, frame->content, PAGE_SIZE, offset) != PAGE_SIZE) {
+    printf("Error writing spill file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  frame->is_dirty = false;
+  stats.page_spills += 1;
+}
+
+void pager_read_spilled (Pager* pager, uint32_t slot, void* page) {
+  if (pread(pager->spill_fd, page, PAGE_SIZE, (off_t)(slot - 1) * PAGE_SIZE) != PAGE_SIZE) {
+    printf("Error reading spill file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// return a frame_id that can hold a new page, -1 if every frame is pinned
+int32_t find_replace (Pager* pager) {
+  int32_t replace_frame_id = -1;
+  if (!is_empty(pager->freelist_)) {
+    return pop_back(pager->freelist_);
+  }
+  if (Victim(pager->replacer_, &replace_frame_id)) {
+    Page_t* victim = &pager->frames_[replace_frame_id];
+    if (victim->is_dirty && pager->spill_fd != -1) {
+      pager_spill(pager, victim);
+    }
+    else if (victim->is_dirty) {
+      pager_flush(pager, victim->page_id);
+    }
+    page_table_remove(pager, victim->page_id);
+  }
+  return replace_frame_id;
+}
+
+/* mmap mode: extend the file so that it covers min_length bytes */
+void pager_grow_mapping (Pager* pager, off_t min_length) {
+  off_t extent = pager->file_length / 8;
+  if (extent < MMAP_MIN_EXTENT) {
+    extent = MMAP_MIN_EXTENT;
+  }
+  off_t new_length = pager->file_length + extent;
+  if (new_length < min_length) {
+    new_length = min_length;
+  }
+  if (new_length > (off_t)MMAP_RESERVE) {
+    printf("Db file outgrew the mmap reserve, reopen without --mmap.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ftruncate(pager->file_descriptor, new_length) == -1) {
+    printf("Error growing file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager->file_length = new_length;
+}
+
+/* mmap mode: the mapping never moves, so fetching a page is pointer arithmetic */
+void* get_mapped_page (Pager* pager, uint32_t page_num) {
+  off_t offset = (off_t)page_num * PAGE_SIZE;
+  if (offset + PAGE_SIZE > pager->file_length) {
+    pager_grow_mapping(pager, offset + PAGE_SIZE);
+  }
 
+  if (page_num >= pager->num_pages) {
+    pager->num_pages = page_num + 1;
+  }
+  return pager->map_ + offset;
+}
+
+/* fetch a page into the pool and pin it, every get_page needs an unpin_page */
 void* get_page(Pager* pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tried to fetch page number %d out of bound.\n", page_num);
+  if (page_num == INVALID_PAGE_ID) {
+    printf("Tried to fetch page number %u out of bound.\n", page_num);
     exit(EXIT_FAILURE);
   }
 
-  if (!pager->pages[page_num]) {
-    // Cache miss. Allocate memory and load from disk.
-    void *page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE; // pager has 'num_pages' page
+  if (pager->map_) {
+    return get_mapped_page(pager, page_num);
+  }
 
-    if (pager->file_length % PAGE_SIZE) {
-      num_pages += 1; 
+  int32_t frame_id = page_table_lookup(pager, page_num);
+  if (frame_id == -1) {
+    // Cache miss. Take a frame from the pool and load from disk.
+    stats.cache_misses += 1;
+    frame_id = find_replace(pager);
+    if (frame_id == -1) {
+      printf("All %d frames are pinned, cannot fetch page %d.\n", pager->num_frames, page_num);
+      exit(EXIT_FAILURE);
     }
 
-    if (page_num <= num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+    Page_t* frame = &pager->frames_[frame_id];
+    ssize_t bytes_read = 0;
+    uint32_t spill_slot = pager_spill_slot(pager, page_num);
+    if (spill_slot != 0) {
+      // changed since the last checkpoint, the db file has an older version
+      pager_read_spilled(pager, spill_slot, frame->content);
+      bytes_read = PAGE_SIZE;
+      stats.page_reads += 1;
+    }
+    else if ((off_t)page_num * PAGE_SIZE < pager->file_length) {
+      lseek(pager->file_descriptor, (off_t)page_num * PAGE_SIZE, SEEK_SET);
+      bytes_read = read(pager->file_descriptor, frame->content, PAGE_SIZE);
       if (bytes_read == -1) {
         printf("Error reading file: %d\n", errno);
         exit(EXIT_FAILURE);
       }
+      stats.page_reads += 1;
     }
+    // pages past the end of file start out zeroed
+    memset(frame->content + bytes_read, 0, PAGE_SIZE - bytes_read);
 
-    pager->pages[page_num] = page; // malloced page, returning to the pager
+    frame->pin_count = 0;
+    frame->is_dirty = false;
+    page_table_insert(pager, page_num, frame_id);
 
     // if allocated new pages, we update pager's count for it.
     if (page_num >= pager->num_pages) {
       pager->num_pages = page_num + 1;
     }
   }
-
-  return pager->pages[page_num];
+  else {
+    stats.cache_hits += 1;
+  }
+
+  Page_t* frame = &pager->frames_[frame_id];
+  if (frame->pin_count++ == 0) {
+    Pin(pager->replacer_, frame_id);
+  }
+  return frame->content;
+}
+
+/* B+ tree mutators call this on every pinned page they write, only dirty frames are written back */
+void mark_page_dirty(Pager* pager, uint32_t page_num) {
+  if (pager->map_) {
+    return; // the kernel tracks dirty mapped pages
+  }
+
+  int32_t frame_id = page_table_lookup(pager, page_num);
+  if (frame_id == -1 || pager->frames_[frame_id].pin_count <= 0) {
+    printf("Tried to dirty page %d which is not pinned.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  pager->frames_[frame_id].is_dirty = true;
+}
+
+/* release one pin, the frame becomes a victim candidate once nobody holds it */
+void unpin_page(Pager* pager, uint32_t page_num) {
+  if (pager->map_) {
+    return; // mapped pages are never evicted by us
+  }
+
+  int32_t frame_id = page_table_lookup(pager, page_num);
+  if (frame_id == -1 || pager->frames_[frame_id].pin_count <= 0) {
+    printf("Tried to unpin page %d which is not pinned.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+
+  if (--pager->frames_[frame_id].pin_count == 0) {
+    UnPin(pager->replacer_, frame_id);
+  }
+}
+
+Pager* pager_open(const char* filename) {
+  int fd = open(filename, O_RDWR | O_CREAT, // Read/Write mode, Create file if doen't exist
+  S_IWUSR | S_IRUSR); // user write permission & read permission
+
+  if (fd == -1) {
+    printf("Unable to open file\n");
+    exit(EXIT_FAILURE);
+  }
+
+  off_t file_length = lseek(fd, 0, SEEK_END);
+
+  Pager* pager = malloc(sizeof(Pager));
+  pager->file_descriptor = fd;
+  pager->file_length = file_length;
+  pager->num_pages = (file_length / PAGE_SIZE);
+  pager->free_head = 0; // num_pages and free_head are taken from the header page by db_open
+
+  if (file_length % PAGE_SIZE != 0) {
+    printf("Db file is not a whole number of pages. Corrupt file.\n");
+    exit(EXIT_FAILURE);   
+  }
+
+  pager->map_ = NULL;
+  pager->spill_fd = -1; // opened by wal_open
+  pager->spill_slots = NULL;
+  pager->spill_capacity = 0;
+  pager->num_spilled = 0;
+  pager->num_frames = 0;
+  pager->frames_ = NULL;
+  if (use_mmap) {
+    // reserve address space for the whole file once, the file itself grows underneath
+    pager->map_ = mmap(NULL, MMAP_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (pager->map_ == MAP_FAILED) {
+      printf("Unable to map file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    return pager;
+  }
+
+  uint32_t num_buckets = 1;
+  while (num_buckets < pool_frames) {
+    num_buckets <<= 1;
+  }
+  pager->page_table_ = malloc(sizeof(int32_t) * num_buckets);
+  pager->page_table_mask_ = num_buckets - 1;
+  memset(pager->page_table_, -1, sizeof(int32_t) * num_buckets);
+
+  pager->num_frames = pool_frames;
+  pager->frames_ = malloc(sizeof(Page_t) * pool_frames);
+  void* pool = malloc((size_t)pool_frames * PAGE_SIZE);
+  for (uint32_t i = 0; i < pool_frames; ++i) {
+    pager->frames_[i].content = pool + (size_t)i * PAGE_SIZE;
+    pager->frames_[i].is_dirty = false;
+    pager->frames_[i].pin_count = 0;
+    pager->frames_[i].page_id = INVALID_PAGE_ID;
+    pager->frames_[i].hash_next = -1;
+  }
+  pager->replacer_ = LRUCacheInit(pool_frames);
+  pager->freelist_ = FreeListInit(pool_frames);
+
+  return pager;
+}
+
+/* Header page: page 0 of the file, the tree starts at page 1 when the file is created
+ * | magic(4) | version(4) | page size(4) | root page(4) | num pages(4) | free list head(4) | num rows(8) | index a root(4) |
+ * the fields are read by db_open, live in Table/Pager meanwhile and are written back by db_close */
+const uint32_t HEADER_PAGE_NUM = 0;
+const uint32_t HEADER_MAGIC = 0x4c514a4d; // "MJQL"
+const uint32_t HEADER_VERSION = 7; // 2: nodes no longer store a parent pointer, 3: keys are zero padded, 4: posting lists, 5: slotted leaves, 6: prefix compressed nodes, 7: index on a
+const uint32_t HEADER_MAGIC_OFFSET = 0;
+const uint32_t HEADER_VERSION_OFFSET = HEADER_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_PAGE_SIZE_OFFSET = HEADER_VERSION_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_ROOT_PAGE_OFFSET = HEADER_PAGE_SIZE_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_NUM_PAGES_OFFSET = HEADER_ROOT_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_FREE_HEAD_OFFSET = HEADER_NUM_PAGES_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_NUM_ROWS_OFFSET = HEADER_FREE_HEAD_OFFSET + sizeof(uint32_t);
+const uint32_t HEADER_INDEX_A_ROOT_OFFSET = HEADER_NUM_ROWS_OFFSET + sizeof(uint64_t);
+const uint32_t ROOT_PAGE_NUM = 1;
+
+uint32_t* header_magic (void* header) {
+  return header + HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* header_version (void* header) {
+  return header + HEADER_VERSION_OFFSET;
+}
+
+uint32_t* header_page_size (void* header) {
+  return header + HEADER_PAGE_SIZE_OFFSET;
+}
+
+uint32_t* header_root_page (void* header) {
+  return header + HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t* header_num_pages (void* header) {
+  return header + HEADER_NUM_PAGES_OFFSET;
+}
+
+// first page of the free page list, 0 if the list is empty
+uint32_t* header_free_head (void* header) {
+  return header + HEADER_FREE_HEAD_OFFSET;
+}
+
+uint64_t* header_num_rows (void* header) {
+  return header + HEADER_NUM_ROWS_OFFSET;
+}
+
+// root page of the index on column a, 0 if there is no index
+uint32_t* header_index_a_root (void* header) {
+  return header + HEADER_INDEX_A_ROOT_OFFSET;
+}
+
+// save what db_open took out of the header page, the page is only written again if that changed
+void db_write_header (Table* table) {
+  Pager* pager = table->pager;
+  void* header = get_page(pager, HEADER_PAGE_NUM);
+  uint32_t index_a_root = index_a ? index_a->root_page_num : 0;
+  if (*header_magic(header) == HEADER_MAGIC && *header_version(header) == HEADER_VERSION
+      && *header_page_size(header) == PAGE_SIZE && *header_root_page(header) == table->root_page_num
+      && *header_num_pages(header) == pager->num_pages && *header_free_head(header) == pager->free_head
+      && *header_num_rows(header) == table->num_rows && *header_index_a_root(header) == index_a_root) {
+    unpin_page(pager, HEADER_PAGE_NUM);
+    return;
+  }
+  mark_page_dirty(pager, HEADER_PAGE_NUM);
+  *header_magic(header) = HEADER_MAGIC;
+  *header_version(header) = HEADER_VERSION;
+  *header_page_size(header) = PAGE_SIZE;
+  *header_root_page(header) = table->root_page_num;
+  *header_num_pages(header) = pager->num_pages;
+  *header_free_head(header) = pager->free_head;
+  *header_num_rows(header) = table->num_rows;
+  *header_index_a_root(header) = index_a_root;
+  unpin_page(pager, HEADER_PAGE_NUM);
+}
+
+// the tree whose root is at root_page_num
+Table* table_open (Pager* pager, uint32_t root_page_num) {
+  Table* tree = malloc(sizeof(Table));
+  tree->pager = pager;
+  tree->root_page_num = root_page_num;
+  tree->num_rows = 0;
+  tree->append_hint = NULL;
+  tree->append_hint_valid = false;
+  return tree;
+}
+
+void table_free (Table* tree) {
+  free(tree->append_hint);
+  free(tree);
+}
+
+/*---------- Write-Ahead Log --------------*/
+
+/* Inserts and deletes are logged before they run, as logical records in <db>-wal, and the db file
+ * only changes at checkpoints. the records are synced in groups, so one fdatasync covers many
+ * statements: when the shell waits for more input, when wal_batch records are pending or when the
+ * oldest of them is wal_interval_ms old. dirty pages the pool evicts meanwhile go to a spill file.
+ * a checkpoint copies every changed page into the log and syncs it before the pages are written
+ * to the db file, so a checkpoint cut off in the middle is redone from the log by db_open, which
+ * then replays the records behind the last checkpoint
+ * | magic(4) | version(4) | page size(4) | salt(4) | records ...
+ * record: | checksum(4) | type(4) | a or page number(4) | b(12) | page (WAL_PAGE only) | */
+
+typedef enum {
+  WAL_INSERT = 1,
+  WAL_DELETE,
+  WAL_PAGE, // image of a page written by a checkpoint
+  WAL_CHECKPOINT // the pages in front of it are complete
+} WalRecordType;
+
+typedef struct {
+  uint32_t checksum; // FNV-1a of the salt and everything behind this field
+  uint32_t type;
+  uint32_t a; // page number of a WAL_PAGE
+  char b[12];
+} WalRecord;
+
+const uint32_t WAL_MAGIC = 0x574c514d; // "MQLW"
+const uint32_t WAL_VERSION = 1;
+const uint32_t WAL_HEADER_SIZE = 4 * sizeof(uint32_t);
+
+struct {
+  int fd; // -1 without the log
+  char* path;
+  uint32_t salt; // changes whenever the log starts over, older records do not check out anymore
+  off_t length; // bytes in the file, 0 until the first record since the log started over
+  char buffer[WAL_BUFFER_SIZE]; // records not written yet
+  uint32_t buffered;
+  uint32_t pending; // records not synced yet
+  uint64_t pending_since; // now_ns() when the oldest of them was logged
+  off_t replay_start; // records db_open replays, found by wal_open
+  off_t replay_end;
+} wal = {.fd = -1};
+
+uint32_t wal_checksum (uint32_t salt, WalRecord* record, void* page) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < sizeof(salt); ++i) {
+    hash = (hash ^ ((salt >> (i * 8)) & 0xFF)) * 16777619u;
+  }
+  unsigned char* bytes = (unsigned char*)record + sizeof(record->checksum);
+  for (uint32_t i = 0; i < sizeof(WalRecord) - sizeof(record->checksum); ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  bytes = page;
+  for (uint32_t i = 0; page && i < PAGE_SIZE; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void wal_write (const void* data, size_t size) {
+  while (size > 0) {
+    ssize_t bytes_written = write(wal.fd, data, size);
+    if (bytes_written <= 0) {
+      printf("Error writing log: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    data += bytes_written;
+    size -= bytes_written;
+    wal.length += bytes_written;
+  }
+}
+
+void wal_write_buffer () {
+  wal_write(wal.buffer, wal.buffered);
+  wal.buffered = 0;
+}
+
+void wal_sync () {
+  if (fdatasync(wal.fd) == -1) {
+    printf("Error syncing log: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  stats.wal_syncs += 1;
+}
+
+void wal_append (uint32_t type, uint32_t a, const char* b, void* page) {
+  WalRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  record.a = a;
+  if (b) {
+    memcpy(record.b, b, sizeof(record.b));
+  }
+  record.checksum = wal_checksum(wal.salt, &record, page);
+
+  // the header goes out with the first record, a log nothing was logged to stays empty
+  if (wal.length == 0 && wal.buffered == 0) {
+    uint32_t header[4] = {WAL_MAGIC, WAL_VERSION, PAGE_SIZE, wal.salt};
+    memcpy(wal.buffer, header, sizeof(header));
+    wal.buffered = sizeof(header);
+  }
+  if (wal.buffered + sizeof(record) > WAL_BUFFER_SIZE) {
+    wal_write_buffer();
+  }
+  memcpy(wal.buffer + wal.buffered, &record, sizeof(record));
+  wal.buffered += sizeof(record);
+  if (page) {
+    wal_write_buffer();
+    wal_write(page, PAGE_SIZE);
+  }
+}
+
+/* the log starts over with a new salt. the empty file needs no sync: the first commit
+ * behind it syncs the new size together with the header and its records */
+void wal_reset () {
+  if (ftruncate(wal.fd, 0) == -1 || lseek(wal.fd, 0, SEEK_SET) == -1) {
+    printf("Error truncating log: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  wal.length = 0;
+  wal.buffered = 0;
+  wal.pending = 0;
+  wal.salt += 1;
+}
+
+// make the statements logged so far durable
+void wal_commit () {
+  if (wal.pending == 0) {
+    return;
+  }
+  wal_write_buffer();
+  wal_sync();
+  wal.pending = 0;
+}
+
+uint64_t now_ns (); // needed function
+
+// called before a statement changes the tree
+void wal_log (uint32_t type, uint32_t a, const char* b) {
+  if (wal.fd == -1) {
+    return;
+  }
+  if (wal.pending == 0) {
+    wal.pending_since = now_ns();
+  }
+  wal_append(type, a, b, NULL);
+  wal.pending += 1;
+}
+
+bool pager_has_dirty (Pager* pager) {
+  for (uint32_t i = 0; i < pager->num_frames; ++i) {
+    if (pager->frames_[i].page_id != INVALID_PAGE_ID && pager->frames_[i].is_dirty) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* write every page changed since the last checkpoint into the db file, the log starts over.
+ * nothing is written or synced if nothing was logged or changed since the last one */
+void wal_checkpoint (Table* table) {
+  if (wal.fd == -1) {
+    return;
+  }
+  Pager* pager = table->pager;
+  db_write_header(table);
+  if (wal.length + wal.buffered == 0 && pager->num_spilled == 0 && !pager_has_dirty(pager)) {
+    return;
+  }
+  void* page = malloc(PAGE_SIZE);
+
+  // 1. the pages go into the log first, spilled ones before the newer ones still in the pool
+  wal_write_buffer();
+  for (uint32_t page_num = 0; page_num < pager->spill_capacity; ++page_num) {
+    if (pager->spill_slots[page_num] != 0) {
+      pager_read_spilled(pager, pager->spill_slots[page_num], page);
+      wal_append(WAL_PAGE, page_num, NULL, page);
+    }
+  }
+  for (uint32_t i = 0; i < pager->num_frames; ++i) {
+    Page_t* frame = &pager->frames_[i];
+    if (frame->page_id != INVALID_PAGE_ID && frame->is_dirty) {
+      wal_append(WAL_PAGE, frame->page_id, NULL, frame->content);
+    }
+  }
+  wal_append(WAL_CHECKPOINT, 0, NULL, NULL);
+  wal_write_buffer();
+  wal_sync();
+
+  // 2. from now on a crash redoes them, the db file may change
+  for (uint32_t page_num = 0; page_num < pager->spill_capacity; ++page_num) {
+    if (pager->spill_slots[page_num] != 0) {
+      pager_read_spilled(pager, pager->spill_slots[page_num], page);
+      off_t offset = (off_t)page_num * PAGE_SIZE;
+      if (pwrite(pager->file_descriptor, page, PAGE_SIZE, offset) != PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      stats.page_writes += 1;
+      if (offset + PAGE_SIZE > pager->file_length) {
+        pager->file_length = offset + PAGE_SIZE;
+      }
+    }
+  }
+  pager_flush_all(pager);
+  if (fdatasync(pager->file_descriptor) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  free(page);
+
+  // 3. nothing in the log or the spill file is needed anymore
+  if (pager->spill_capacity) { // no slots yet before the first spill
+    memset(pager->spill_slots, 0, sizeof(uint32_t) * pager->spill_capacity);
+  }
+  pager->num_spilled = 0;
+  if (ftruncate(pager->spill_fd, 0) == -1) {
+    printf("Error truncating spill file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  wal_reset();
+  stats.checkpoints += 1;
+}
+
+/* called between statements: sync or checkpoint when it is time to.
+ * the interval is only looked at here, so it bounds the delay while statements keep coming.
+ * the shell never sits idle on unsynced records: read_byte commits before every read() that may
+ * block, and while the input block is not used up the next statement is already there */
+void wal_statement_done (Table* table) {
+  if (wal.fd == -1) {
+    return;
+  }
+  if (wal.pending >= wal_batch
+      || (wal.pending > 0 && wal_interval_ms > 0 && now_ns() - wal.pending_since >= wal_interval_ms * 1000000ULL)) {
+    wal_commit();
+  }
+  if (table->pager->num_spilled >= CHECKPOINT_SPILL_PAGES || wal.length + wal.buffered >= CHECKPOINT_WAL_BYTES) {
+    wal_checkpoint(table);
+  }
+}
+
+// the record at offset and the page behind it, false at the end of the log or at a torn record
+bool wal_read_record (off_t offset, WalRecord* record, void* page) {
+  if (pread(wal.fd, record, sizeof(WalRecord), offset) != sizeof(WalRecord)) {
+    return false;
+  }
+  if (record->type == WAL_PAGE && pread(wal.fd, page, PAGE_SIZE, offset + sizeof(WalRecord)) != PAGE_SIZE) {
+    return false;
+  }
+  return record->type >= WAL_INSERT && record->type <= WAL_CHECKPOINT
+      && record->checksum == wal_checksum(wal.salt, record, record->type == WAL_PAGE ? page : NULL);
+}
+
+off_t wal_record_size (WalRecord* record) {
+  return sizeof(WalRecord) + (record->type == WAL_PAGE ? PAGE_SIZE : 0);
+}
+
+/* open the log of the db, redo a checkpoint it holds and remember the records db_open replays */
+void wal_open (Pager* pager, const char* filename) {
+  size_t length = strlen(filename);
+  wal.path = malloc(length + sizeof("-spill"));
+  memcpy(wal.path, filename, length);
+  strcpy(wal.path + length, "-spill");
+  pager->spill_fd = open(wal.path, O_RDWR | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  if (pager->spill_fd == -1) {
+    printf("Unable to open spill file\n");
+    exit(EXIT_FAILURE);
+  }
+  unlink(wal.path); // lives as long as the process
+  strcpy(wal.path + length, "-wal");
+  wal.fd = open(wal.path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (wal.fd == -1) {
+    printf("Unable to open log\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // a log without a whole header is empty
+  uint32_t header[4] = {0};
+  wal.salt = (uint32_t)time(NULL);
+  wal.replay_start = wal.replay_end = WAL_HEADER_SIZE;
+  wal.length = lseek(wal.fd, 0, SEEK_END);
+  if (pread(wal.fd, header, sizeof(header), 0) != sizeof(header) || header[0] != WAL_MAGIC) {
+    return;
+  }
+  if (header[1] != WAL_VERSION || header[2] != PAGE_SIZE) {
+    printf("Log file was written by another version or with another page size.\n");
+    exit(EXIT_FAILURE);
+  }
+  wal.salt = header[3];
+
+  // find the end of the log and the last checkpoint in it
+  WalRecord record;
+  void* page = malloc(PAGE_SIZE);
+  off_t offset = WAL_HEADER_SIZE;
+  off_t checkpoint_end = 0;
+  while (wal_read_record(offset, &record, page)) {
+    offset += wal_record_size(&record);
+    if (record.type == WAL_CHECKPOINT) {
+      checkpoint_end = offset;
+    }
+  }
+  wal.replay_end = offset;
+
+  // the db file may hold some pages of that checkpoint only, write all of them again
+  if (checkpoint_end != 0) {
+    for (offset = WAL_HEADER_SIZE; offset < checkpoint_end; offset += wal_record_size(&record)) {
+      wal_read_record(offset, &record, page);
+      if (record.type != WAL_PAGE) {
+        continue;
+      }
+      off_t page_offset = (off_t)record.a * PAGE_SIZE;
+      if (pwrite(pager->file_descriptor, page, PAGE_SIZE, page_offset) != PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      if (page_offset + PAGE_SIZE > pager->file_length) {
+        pager->file_length = page_offset + PAGE_SIZE;
+      }
+    }
+    if (fdatasync(pager->file_descriptor) == -1) {
+      printf("Error syncing db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    pager->num_pages = pager->file_length / PAGE_SIZE;
+    wal.replay_start = checkpoint_end;
+  }
+  free(page);
 }
 
-Pager* pager_open(const char* filename) {
-  int fd = open(filename, O_RDWR | O_CREAT, // Read/Write mode, Create file if doen't exist
-  S_IWUSR | S_IRUSR); // user write permission & read permission
+void wal_apply (uint32_t type, uint32_t a, char* b); // needed function
 
-  if (fd == -1) {
-    printf("Unable to open file\n");
-    exit(EXIT_FAILURE);
+/* run the statements logged behind the last checkpoint again and checkpoint them,
+   the log is empty afterwards */
+void wal_replay (Table* table) {
+  bool recovered = wal.replay_end > WAL_HEADER_SIZE;
+  WalRecord record;
+  for (off_t offset = wal.replay_start; offset < wal.replay_end; offset += wal_record_size(&record)) {
+    if (pread(wal.fd, &record, sizeof(record), offset) != sizeof(record)) {
+      printf("Error reading log: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    if (record.type == WAL_INSERT || record.type == WAL_DELETE) {
+      wal_apply(record.type, record.a, record.b);
+    }
   }
-
-  off_t file_length = lseek(fd, 0, SEEK_END);
-
-  Pager* pager = malloc(sizeof(Pager));
-  pager->file_descriptor = fd;
-  pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
-
-  if (file_length % PAGE_SIZE != 0) {
-    printf("Db file is not a whole number of pages. Corrupt file.\n");
-    exit(EXIT_FAILURE);   
+  if (recovered) {
+    // a torn record or garbage behind the last good one goes first, or the next open would
+    // stop at it and miss the checkpoint written behind it
+    if (ftruncate(wal.fd, wal.replay_end) == -1 || lseek(wal.fd, wal.replay_end, SEEK_SET) == -1) {
+      printf("Error truncating log: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    wal.length = wal.replay_end;
+    wal_checkpoint(table);
   }
-
-  for (int32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-    pager->pages[i] = NULL;
+  else if (wal.length > 0) {
+    wal_reset(); // nothing to replay, whatever is in the file goes
   }
+}
 
-  return pager;
+// true if the db has a log with something in it, an open without the log would pass it by
+bool wal_left_behind (const char* filename) {
+  size_t length = strlen(filename);
+  char* path = malloc(length + sizeof("-wal"));
+  memcpy(path, filename, length);
+  strcpy(path + length, "-wal");
+  struct stat info;
+  bool found = stat(path, &info) == 0 && info.st_size > 0;
+  free(path);
+  return found;
 }
 
-uint32_t get_unused_page_num (Pager* pager) {
-  return pager->num_pages;
+// after the last checkpoint the db file is complete, the log goes away
+void wal_close (Pager* pager) {
+  close(wal.fd);
+  unlink(wal.path);
+  free(wal.path);
+  wal.fd = -1;
+  close(pager->spill_fd);
+  free(pager->spill_slots);
 }
 
+/*---------------------------------------------*/
+
 // open database and do preparations
 void initialize_leaf_node(void*); // needed functions
 void set_node_root(void*, bool);
 Table* db_open(const char* filename) {
+  // the statements in a log are only safe if it is replayed, which needs the pool
+  if ((use_mmap || !use_wal) && wal_left_behind(filename)) {
+    printf("Db has a write-ahead log to recover, open it once without --mmap and --no-wal.\n");
+    exit(EXIT_FAILURE);
+  }
   Pager* pager = pager_open(filename);
+  if (use_wal && !use_mmap) {
+    wal_open(pager, filename);
+  }
 
-  Table* table = malloc(sizeof(Table));
-  table->pager = pager;
-  table->root_page_num = 0;
+  Table* table = table_open(pager, ROOT_PAGE_NUM);
 
   if (pager->num_pages == 0) {
-    // New database file, Initialize page 0 as leaf node
-    void* root_node = get_page(pager, 0);
+    // New database file, Initialize the header page and page 1 as leaf node
+    db_write_header(table);
+
+    void* root_node = get_page(pager, ROOT_PAGE_NUM);
+    mark_page_dirty(pager, ROOT_PAGE_NUM);
     initialize_leaf_node(root_node);
     set_node_root(root_node, true);
+    unpin_page(pager, ROOT_PAGE_NUM);
   }
-  return table;
-}
-
-// write back the page, only with complete pages
-void pager_flush(Pager* pager, uint32_t page_num) {
-  if (pager->pages[page_num] == NULL) {
-     printf("Tried to flush null page\n");
-     exit(EXIT_FAILURE);
-  }
-
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE,
-     		 SEEK_SET);
-
-  if (offset == -1) {
-     printf("Error seeking: %d\n", errno);
-     exit(EXIT_FAILURE);
-  }
-
-  ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-  // printf("Had Written: %ld\n", bytes_written);
-  if (bytes_written == -1) {
-     printf("Error writing: %d\n", errno);
-     exit(EXIT_FAILURE);
+  else {
+    void* header = get_page(pager, HEADER_PAGE_NUM);
+    if (*header_magic(header) != HEADER_MAGIC || *header_version(header) != HEADER_VERSION) {
+      printf("Db file is not a myjql database, or was written by another version.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (*header_page_size(header) != PAGE_SIZE) {
+      printf("Db file uses %d byte pages, expected %d.\n", *header_page_size(header), PAGE_SIZE);
+      exit(EXIT_FAILURE);
+    }
+    table->root_page_num = *header_root_page(header);
+    table->num_rows = *header_num_rows(header);
+    pager->num_pages = *header_num_pages(header);
+    pager->free_head = *header_free_head(header);
+    if (*header_index_a_root(header) != 0) {
+      index_a = table_open(pager, *header_index_a_root(header));
+    }
+    unpin_page(pager, HEADER_PAGE_NUM);
   }
+  return table;
 }
 
 // close the file
+void print_stats(); // needed function
 void db_close(Table* table) {
   Pager* pager = table->pager;
 
-  for (uint32_t i = 0; i < pager->num_pages; ++i) {
-    if (!pager->pages[i]) {
-      continue;
+  db_write_header(table);
+
+  if (pager->map_) {
+    if (stats_at_close) {
+      print_stats();
+    }
+    // dirty mapped pages reach the file through the page cache, only cut off the unused extent
+    munmap(pager->map_, MMAP_RESERVE);
+    if (ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+      printf("Error truncating file: %d\n", errno);
+      exit(EXIT_FAILURE);
     }
+    close(pager->file_descriptor);
+    free(pager);
+    if (index_a) {
+      table_free(index_a);
+    }
+    table_free(table);
+    return;
+  }
 
-    // write back these pages & free memory
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+  // write back every dirty frame still in the pool, through the log if there is one
+  if (wal.fd != -1) {
+    wal_checkpoint(table);
   }
-  
+  else {
+    pager_flush_all(pager);
+  }
+  // after the writes of closing, the frames are still there for the tree heights
+  if (stats_at_close) {
+    print_stats();
+  }
+  if (wal.fd != -1) {
+    wal_close(pager);
+  }
+
   int result = close(pager->file_descriptor);
   if (result == -1) {
     printf("Error closing db file.\n");
     exit(EXIT_FAILURE);
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-    void* page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
-    }
+  free(pager->frames_[0].content); // the whole pool is one allocation
+  free(pager->frames_);
+  free(pager->page_table_);
+  LRUCacheFree(pager->replacer_);
+  FreeListFree(pager->freelist_);
+  free(pager);
+  if (index_a) {
+    table_free(index_a);
   }
+  table_free(table);
+}
 
-  free(pager);
-  free(table);
+/*-------Keys------------*/
+
+/* keys (column b) are stored zero padded to 12 bytes, so comparing them as one
+ * big-endian 8-byte integer followed by a 4-byte one gives the order of strcmp */
+static inline uint64_t key_high (const void* key) {
+  uint64_t value;
+  memcpy(&value, key, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static inline uint32_t key_low (const void* key) {
+  uint32_t value;
+  memcpy(&value, (const char*)key + sizeof(uint64_t), sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap32(value);
+#endif
+  return value;
+}
+
+// < 0, 0, > 0 like strcmp
+static inline int key_compare (const void* a, const void* b) {
+  uint64_t a_high = key_high(a);
+  uint64_t b_high = key_high(b);
+  if (a_high != b_high) {
+    return a_high < b_high ? -1 : 1;
+  }
+  uint32_t a_low = key_low(a);
+  uint32_t b_low = key_low(b);
+  return (a_low > b_low) - (a_low < b_low);
+}
+
+// < 0, 0, > 0 like memcmp of the first length bytes of key with prefix, both 12 bytes readable
+static inline int key_prefix_compare (const void* key, const void* prefix, uint32_t length) {
+  uint64_t high_mask = length >= 8 ? ~0ULL : (length ? ~0ULL << (8 * (8 - length)) : 0);
+  uint32_t low_mask = length <= 8 ? 0 : ~0U << (8 * (12 - length));
+  uint64_t key_h = key_high(key) & high_mask;
+  uint64_t prefix_h = key_high(prefix) & high_mask;
+  if (key_h != prefix_h) {
+    return key_h < prefix_h ? -1 : 1;
+  }
+  uint32_t key_l = key_low(key) & low_mask;
+  uint32_t prefix_l = key_low(prefix) & low_mask;
+  return (key_l > prefix_l) - (key_l < prefix_l);
+}
+
+/* nodes keep the bytes [start, start + size) of their keys behind a common prefix.
+ * a window is compared like key_compare: the 12 bytes ending with it are read as
+ * the 8 + 4 byte integers and the bytes in front of it are masked off.
+ * the bytes in front of a cell are always inside its page */
+typedef struct {
+  uint64_t high_mask;
+  uint32_t low_mask;
+  uint64_t high; // of the key searched for
+  uint32_t low;
+} KeyWindow;
+
+static inline void key_window_init (KeyWindow* window, const char* key, uint32_t start, uint32_t size) {
+  char padded[24] = {0};
+  memcpy(padded + 12, key, 12);
+  const char* end = padded + 12 + start + size;
+  window->high_mask = size <= 4 ? 0 : (size >= 12 ? ~0ULL : (1ULL << (8 * (size - 4))) - 1);
+  window->low_mask = size >= 4 ? ~0U : (1U << (8 * size)) - 1;
+  window->high = key_high(end - 12) & window->high_mask;
+  window->low = key_low(end - 12) & window->low_mask;
+}
+
+// < 0, 0, > 0 like memcmp of the window ending at end with the one of the key searched for
+static inline int key_window_compare (const KeyWindow* window, const char* end) {
+  uint64_t high = key_high(end - 12) & window->high_mask;
+  if (high != window->high) {
+    return high < window->high ? -1 : 1;
+  }
+  uint32_t low = key_low(end - 12) & window->low_mask;
+  return (low > window->low) - (low < window->low);
+}
+
+// number of bytes up to the last non zero one
+uint32_t key_length (const char* key) {
+  uint32_t length = 12;
+  while (length > 0 && key[length - 1] == 0) {
+    --length;
+  }
+  return length;
+}
+
+// number of leading bytes a and b have in common, at most max_length
+uint32_t key_common_prefix (const char* a, const char* b, uint32_t max_length) {
+  uint32_t length = 0;
+  while (length < max_length && a[length] == b[length]) {
+    ++length;
+  }
+  return length;
+}
+
+/* the separator of two neighbouring nodes, any s with left_max <= s < right_min does.
+ * right_min cut short behind the first byte it differs from left_max in is the shortest,
+ * left_max itself is taken when cutting would not make it shorter or not smaller than right_min */
+void key_separator (const char* left_max, const char* right_min, char* separator) {
+  uint32_t common = key_common_prefix(left_max, right_min, 12);
+  if (common + 1 < key_length(left_max) && common + 1 < key_length(right_min)) {
+    memset(separator, 0, 12);
+    memcpy(separator, right_min, common + 1);
+  }
+  else {
+    memcpy(separator, left_max, 12);
+  }
 }
 
+/*-------------------------*/
+
 /*-------Cursors------------*/
 
 /* Cursor for B-Tree index */
-typedef struct {
+typedef struct Cursor {
   Table* table; // Table that cursor points to.
   uint32_t page_num; // cursor points to which page.
   uint32_t cell_num; // cursor points to which <key, value> cell.
   bool end_of_table; // reached end ?
+
+  /* root-to-leaf path recorded by table_find, nodes keep no parent pointers */
+  uint32_t depth; // number of internal nodes above the leaf
+  uint32_t path[MAX_TREE_DEPTH]; // internal page at each level, path[0] is the root
+  uint32_t path_index[MAX_TREE_DEPTH]; // child taken at each level
+  bool appending; // the leaf was split for a key behind the largest one, parents split unevenly too
 } Cursor;
 
 typedef enum {
-  NODE_INTERNAL, NODE_LEAF
+  NODE_INTERNAL, NODE_LEAF, NODE_FREE, NODE_OVERFLOW
 } NodeType;
 
+/* every tree remembers the path to its rightmost leaf when table_find passes there, so that
+ * keys appended behind the largest one can skip the descent. splits, merges and
+ * redistributions drop it */
+
 /* needed declarations */
 uint32_t* leaf_node_num_cells(void*);
 NodeType get_node_type(void*);
 void* leaf_node_cell (void* node, uint32_t cell_num);
-char* leaf_node_key(void*, uint32_t);
+void leaf_node_get_key (void* node, uint32_t cell_num, char* key);
+uint32_t leaf_node_find_key_index (void* node, char* key);
 
 /* Cursor finding value in leafnode pages */
-Cursor* leaf_node_find (Table* table, uint32_t page_num, char* key) {
-  void* node = get_page(table->pager, page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+void leaf_node_find (Cursor* cursor, uint32_t page_num, char* key) {
+  void* node = get_page(cursor->table->pager, page_num);
 
-  Cursor* cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
   cursor->page_num = page_num;
+  cursor->end_of_table = false;
+  // leftmost position of key, so duplicates are found (and inserted) in front
+  cursor->cell_num = leaf_node_find_key_index(node, key);
 
-  // Using Binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    char* key_at_index = leaf_node_key(node, index); // a pointer to the array position(address stored)
-
-    int cmp = strcmp(key, key_at_index);
-    if (cmp == 0) {
-      // TODO: find the leftmost pos of same keys, then do insert
-      int32_t test_index = index;
-      while (test_index >= 0) {
-        // printf("Test Index is: %d\n", test_index);
-        char* same_key = leaf_node_key(node, test_index);
-        if (strcmp(key, same_key)) {
-          break;
-        } else {
-          --test_index;
-        }
-      }
-      min_index = test_index + 1;
-      break;
-    }
-    else if (cmp < 0) { // current key is smaller than spotted key
-      one_past_max_index = index;
-    } else {
-      min_index = index + 1;
-    }
-  }
-  // printf("Index where %s is going to insert is: %d\n", key, min_index);
-  cursor->cell_num = min_index;
-
-  return cursor;  
+  unpin_page(cursor->table->pager, page_num);
 }
 
-/* Cursor finding value in internal nodes */
+/* needed declarations */
 uint32_t* internal_node_num_keys(void*);
-char* internal_node_key(void*, uint32_t);
 uint32_t* internal_node_child (void*, uint32_t);
 uint32_t* leaf_node_next_leaf(void*);
 uint32_t internal_node_find_child (void* node, char* key);
-uint32_t* node_parent(void* node);
-void print_internal_node_info (void*, uint32_t);
 
-Cursor* internal_node_find (Table* table, uint32_t page_num, char* key) {
-  void* node = get_page(table->pager, page_num); 
-  uint32_t child_index = internal_node_find_child(node, key);
-  uint32_t child_page_id = *internal_node_child(node, child_index);
-  
-  void* child_page = get_page(table->pager, child_page_id);
-  // printf("Now we're looking in internal nodes! Page is: %d, Key_num is: %d\n", child_page_id, *internal_node_num_keys(node));
+/* Given key, find where the key to be inserted into.
+ * the internal nodes passed on the way down are kept in the cursor,
+ * splits and merges walk back up along them. the caller owns the cursor, usually on its stack */
+void table_find (Table* table, char* key, Cursor* cursor) {
+  cursor->table = table;
+  cursor->depth = 0;
+  cursor->appending = false;
+  bool rightmost = true;
 
-  switch (get_node_type(child_page)) {
-    case NODE_LEAF: return leaf_node_find(table, child_page_id, key);
-    case NODE_INTERNAL: return internal_node_find(table, child_page_id, key);
-    default: break;
+  uint32_t page_num = table->root_page_num;
+  void* node = get_page(table->pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    if (cursor->depth == MAX_TREE_DEPTH) {
+      printf("Tree is deeper than %d levels.\n", MAX_TREE_DEPTH);
+      exit(EXIT_FAILURE);
+    }
+    uint32_t child_index = internal_node_find_child(node, key);
+    rightmost = rightmost && child_index == *internal_node_num_keys(node);
+    uint32_t child_page_num = *internal_node_child(node, child_index);
+    cursor->path[cursor->depth] = page_num;
+    cursor->path_index[cursor->depth] = child_index;
+    cursor->depth += 1;
+
+    unpin_page(table->pager, page_num);
+    page_num = child_page_num;
+    node = get_page(table->pager, page_num);
   }
-}
+  unpin_page(table->pager, page_num);
 
-/* Given key, find where the key to be inserted into. */
-Cursor* table_find (Table* table, char* key) {
-  uint32_t root_page_num = table->root_page_num;
-  void* root_node = get_page(table->pager, root_page_num);
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    return internal_node_find(table, root_page_num, key);
+  leaf_node_find(cursor, page_num, key);
+  if (rightmost) {
+    if (table->append_hint == NULL) {
+      table->append_hint = malloc(sizeof(Cursor));
+    }
+    *table->append_hint = *cursor;
+    table->append_hint_valid = true;
   }
 }
 
-/* Cursor points to the start of table */
-Cursor* table_start (Table* table) {
-  char* min_key = "0";
-  Cursor* cursor = table_find(table, min_key);
-  // printf("Starting Page num is: %d\n", cursor->page_num);
+/* set cursor for inserting key at the right end of the tree without descending,
+ * false if there is no append hint or key is smaller than the largest key */
+bool table_find_append (Table* table, char* key, Cursor* cursor) {
+  if (!table->append_hint_valid) {
+    return false;
+  }
+  Cursor* append_hint = table->append_hint;
+  void* node = get_page(table->pager, append_hint->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  int cmp = -1;
+  if (num_cells > 0) {
+    char max_key[12];
+    leaf_node_get_key(node, num_cells - 1, max_key);
+    cmp = key_compare(key, max_key);
+  }
+  unpin_page(table->pager, append_hint->page_num);
+  if (cmp < 0) {
+    return false;
+  }
+
+  *cursor = *append_hint;
+  cursor->table = table;
+  cursor->end_of_table = false;
+  cursor->cell_num = cmp == 0 ? num_cells - 1 : num_cells;
+  return true;
+}
 
-  void* node = get_page(table->pager, cursor->page_num);
+/* a stale separator may leave the cursor one past the last cell of a leaf,
+   move it to the first cell of the next leaf in that case.
+   the path is moved along, so the cursor can still be used for deletes */
+void cursor_skip_leaf_end(Cursor* cursor) {
+  Pager* pager = cursor->table->pager;
+  void* node = get_page(pager, cursor->page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
-  cursor->end_of_table = (num_cells == 0);
+  unpin_page(pager, cursor->page_num);
+  if (cursor->end_of_table || cursor->cell_num < num_cells) {
+    return;
+  }
 
-  return cursor;
+  // climb until some node still has a child right of the path
+  uint32_t level = cursor->depth;
+  while (level > 0) {
+    node = get_page(pager, cursor->path[level - 1]);
+    bool has_right = cursor->path_index[level - 1] < *internal_node_num_keys(node);
+    unpin_page(pager, cursor->path[level - 1]);
+    if (has_right) {
+      break;
+    }
+    --level;
+  }
+  if (level == 0) {
+    /* reached rightmost leaf */
+    cursor->end_of_table = true;
+    return;
+  }
+
+  // step right once, then down along the leftmost children
+  cursor->path_index[level - 1] += 1;
+  node = get_page(pager, cursor->path[level - 1]);
+  uint32_t page_num = *internal_node_child(node, cursor->path_index[level - 1]);
+  unpin_page(pager, cursor->path[level - 1]);
+  for (; level < cursor->depth; ++level) {
+    cursor->path[level] = page_num;
+    cursor->path_index[level] = 0;
+    node = get_page(pager, page_num);
+    uint32_t child_page_num = *internal_node_child(node, 0);
+    unpin_page(pager, page_num);
+    page_num = child_page_num;
+  }
+  cursor->page_num = page_num;
+  cursor->cell_num = 0;
 }
 
-/* cursor value 包含了叶子节点的一条记录(char[12]+int) */
-void* cursor_value (Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* page = get_page(cursor->table->pager, page_num);
-  return leaf_node_cell(page, cursor->cell_num);
+/* Cursor points to the start of table */
+void table_start (Table* table, Cursor* cursor) {
+  char min_key[12] = {0}; // the empty key sorts before everything
+  table_find(table, min_key, cursor);
+  // printf("Starting Page num is: %d\n", cursor->page_num);
+  cursor_skip_leaf_end(cursor);
 }
 
 void cursor_advance(Cursor* cursor) {
   uint32_t page_num = cursor->page_num;
   void* node = get_page(cursor->table->pager, page_num);
-  uint32_t parent_id = *node_parent(node);
   cursor->cell_num += 1;
-  // printf("Now we're visiting Page: %d, its Parent is Page [%d]\n", page_num, parent_id);
 
   if (cursor->cell_num >= *leaf_node_num_cells(node)) {
     uint32_t next_page_num = *leaf_node_next_leaf(node);
@@ -337,29 +1538,49 @@ void cursor_advance(Cursor* cursor) {
       cursor->cell_num = 0;
     }
   }
+  unpin_page(cursor->table->pager, page_num);
 }
 
 /*-------------------------*/
 
 
 /* shell io */
-void print_prompt() { printf("myjql> "); }
+void print_prompt() {
+  if (!batch_mode) {
+    printf("myjql> ");
+  }
+}
+
+// next byte of stdin, EOF at its end
+static inline int read_byte() {
+  if (input_block.position == input_block.length) {
+    wal_commit(); // the statements so far are durable before the shell waits for more
+    ssize_t bytes_read = read(STDIN_FILENO, input_block.data, INPUT_BLOCK_SIZE);
+    if (bytes_read <= 0) {
+      return EOF;
+    }
+    input_block.length = bytes_read;
+    input_block.position = 0;
+  }
+  return (unsigned char)input_block.data[input_block.position++];
+}
 
 InputResult read_input() {
-  /* we read the entire line as the input */
+  /* we read the entire line as the input, a line cut off by the end of the input is dropped */
   input_buffer.length = 0;
-  while (input_buffer.length <= INPUT_BUFFER_SIZE
-    && (input_buffer.buffer[input_buffer.length++] = getchar()) != '\n'
-    && input_buffer.buffer[input_buffer.length - 1] != EOF);
-  if (input_buffer.buffer[input_buffer.length - 1] == EOF)
-    exit(EXIT_SUCCESS);
-  input_buffer.length--;
-  /* if the last character is not new-line, the input is considered too long,
-     the remaining characters are discarded */
-  if (input_buffer.length == INPUT_BUFFER_SIZE
-    && input_buffer.buffer[input_buffer.length] != '\n') {
-    while (getchar() != '\n');
-    return INPUT_TOO_LONG;
+  int c;
+  while ((c = read_byte()) != '\n') {
+    if (c == EOF) {
+      clean_exit = true;
+      exit(EXIT_SUCCESS);
+    }
+    /* if there is no new-line behind INPUT_BUFFER_SIZE characters, the input is considered
+       too long, the remaining characters are discarded */
+    if (input_buffer.length == INPUT_BUFFER_SIZE) {
+      while ((c = read_byte()) != '\n' && c != EOF);
+      return INPUT_TOO_LONG;
+    }
+    input_buffer.buffer[input_buffer.length++] = c;
   }
   input_buffer.buffer[input_buffer.length] = 0;
   return INPUT_SUCCESS;
@@ -368,6 +1589,10 @@ InputResult read_input() {
 void open_file(const char* filename) {
   /* open file */
   table = db_open(filename);
+  // statements logged after the last checkpoint run again, they work on the global table
+  if (wal.fd != -1) {
+    wal_replay(table);
+  }
 }
 
 void exit_nicely(int code) {
@@ -377,7 +1602,12 @@ void exit_nicely(int code) {
 }
 
 void exit_success() {
-  printf("bye~\n");
+  if (!clean_exit) {
+    return;
+  }
+  if (!batch_mode) {
+    printf("bye~\n");
+  }
   exit_nicely(EXIT_SUCCESS);
 }
 
@@ -390,8 +1620,30 @@ typedef struct {
   char b[COLUMN_B_SIZE + 1];
 } Row;
 
+// "(a, b)", formatted by hand since it runs for every row printed
 void print_row(Row* row) {
-  printf("(%d, %s)\n", row->a, row->b);
+  char line[sizeof("(4294967295, )\n") + COLUMN_B_SIZE];
+  char digits[10];
+  uint32_t num_digits = 0;
+  uint32_t a = row->a;
+  do {
+    digits[num_digits++] = '0' + a % 10;
+    a /= 10;
+  } while (a > 0);
+
+  uint32_t length = 0;
+  line[length++] = '(';
+  while (num_digits > 0) {
+    line[length++] = digits[--num_digits];
+  }
+  line[length++] = ',';
+  line[length++] = ' ';
+  size_t b_length = strnlen(row->b, COLUMN_B_SIZE);
+  memcpy(line + length, row->b, b_length);
+  length += b_length;
+  line[length++] = ')';
+  line[length++] = '\n';
+  fwrite(line, 1, length, stdout);
 }
 
 /* statement */
@@ -405,24 +1657,10 @@ typedef enum {
 struct {
   StatementType type;
   Row row;
-  uint8_t flag; /* whether row.a, row.b have valid values */
+  uint8_t flag; /* whether row.a, row.b have valid values, 4: row.b to hi is a range, 8: row.b is a prefix */
+  char hi[COLUMN_B_SIZE + 1]; /* last key of a range */
 } statement;
 
-/* helper functions */
-
-/* serialize row info into bytes */
-void serialize_row(Row* source, void* destination) {
-  // |-----b------|------a------|
-  //    char(12)       int    
-  memcpy(destination + 0, &(source->b), 12);
-  memcpy(destination + 12, &(source->a), 4);
-}
-
-void deserialize_row(void* source, Row* destination) {
-  memcpy(&(destination->b), source + 0, 12);
-  memcpy(&(destination->a), source + 12, 4);
-}
-
 /* B+ Tree Structures */
 
 /* Common Node Header Formats */
@@ -430,45 +1668,73 @@ const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE;
 
 /* Leaf Node Header Formats */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
-
-/* Leaf Node Body Formats */
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(char[12]); // index on B
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_HEAP_START_SIZE = sizeof(uint32_t); // cells occupy [heap start, PAGE_SIZE)
+const uint32_t LEAF_NODE_HEAP_START_OFFSET = LEAF_NODE_NEXT_LEAF_SIZE_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_PREFIX_LENGTH_SIZE = sizeof(uint16_t); // leading bytes all keys of the leaf share
+const uint32_t LEAF_NODE_PREFIX_LENGTH_OFFSET = LEAF_NODE_HEAP_START_OFFSET + LEAF_NODE_HEAP_START_SIZE;
+const uint32_t LEAF_NODE_PREFIX_SIZE = sizeof(char[12]);
+const uint32_t LEAF_NODE_PREFIX_OFFSET = LEAF_NODE_PREFIX_LENGTH_OFFSET + LEAF_NODE_PREFIX_LENGTH_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_HEAP_START_SIZE
+                                       + LEAF_NODE_PREFIX_LENGTH_SIZE + LEAF_NODE_PREFIX_SIZE;
+
+/* Leaf Node Body Formats
+ * a sorted array of 2-byte slots grows from the front of the page, each slot holds the offset
+ * of a cell in the heap at the back. cells are not kept in order, inserts and deletes only move slots.
+ * a cell is a distinct key without the prefix kept in the header, the length of its posting list and
+ * the list: the `a` values, newest first. a list longer than LEAF_NODE_MAX_POSTING moves to overflow
+ * pages, the cell keeps the page number */
+const uint32_t LEAF_NODE_SLOT_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(char[12]); // index on B, the cell holds the bytes behind the prefix
+const uint32_t LEAF_NODE_POSTING_COUNT_SIZE = sizeof(uint16_t); // number of values, or POSTING_OVERFLOW
+const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_POSTING_COUNT_SIZE; // without the posting list, at most
+const uint32_t LEAF_NODE_VALUE_SIZE = sizeof(uint32_t); // one entry of a posting list
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE - 1;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_LEFT_SPLIT_COUNT;
-const uint32_t LEAF_NODE_MIN_CELLS = LEAF_NODE_MAX_CELLS / 2;
+const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + LEAF_NODE_CELL_SIZE + LEAF_NODE_VALUE_SIZE); // keys without duplicates
+// a cell with its slot and posting list takes at most a quarter of the page, so a split always makes room
+const uint32_t LEAF_NODE_MAX_POSTING = (LEAF_NODE_SPACE_FOR_CELLS / 4 - LEAF_NODE_SLOT_SIZE - LEAF_NODE_CELL_SIZE) / LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_MIN_BYTES = LEAF_NODE_SPACE_FOR_CELLS / 3; // less than this underflows
+#define POSTING_OVERFLOW UINT16_MAX
+
+/* Overflow Page Formats
+ * values of a long posting list, oldest first within a page. the leaf points at the newest
+ * page and each page at the next older one */
+const uint32_t OVERFLOW_NODE_NEXT_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_NODE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t OVERFLOW_NODE_NUM_VALUES_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_NODE_NUM_VALUES_OFFSET = OVERFLOW_NODE_NEXT_OFFSET + OVERFLOW_NODE_NEXT_SIZE;
+const uint32_t OVERFLOW_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + OVERFLOW_NODE_NEXT_SIZE + OVERFLOW_NODE_NUM_VALUES_SIZE;
+const uint32_t OVERFLOW_NODE_MAX_VALUES = (PAGE_SIZE - OVERFLOW_NODE_HEADER_SIZE) / LEAF_NODE_VALUE_SIZE;
 
 /* Internal Node Header Layout */
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t); // pointer to rightmost child's page_num
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
-
-/* Internal Node Body Layout */
+const uint32_t INTERNAL_NODE_PREFIX_LENGTH_SIZE = sizeof(uint16_t); // leading bytes all separators share
+const uint32_t INTERNAL_NODE_PREFIX_LENGTH_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_SUFFIX_SIZE_SIZE = sizeof(uint16_t); // bytes of a separator kept in its cell
+const uint32_t INTERNAL_NODE_SUFFIX_SIZE_OFFSET = INTERNAL_NODE_PREFIX_LENGTH_OFFSET + INTERNAL_NODE_PREFIX_LENGTH_SIZE;
+const uint32_t INTERNAL_NODE_PREFIX_SIZE = sizeof(char[12]);
+const uint32_t INTERNAL_NODE_PREFIX_OFFSET = INTERNAL_NODE_SUFFIX_SIZE_OFFSET + INTERNAL_NODE_SUFFIX_SIZE_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE
+                                           + INTERNAL_NODE_PREFIX_LENGTH_SIZE + INTERNAL_NODE_SUFFIX_SIZE_SIZE + INTERNAL_NODE_PREFIX_SIZE;
+
+/* Internal Node Body Layout
+ * a cell is a child and the bytes of its separator behind the prefix, as many as the longest
+ * separator of the node needs. separators are zero padded behind that, and are cut short where
+ * they are made, so the cells stay narrow */
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(char[12]);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t); // pointer to child page_num(page_id)
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
 const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
-const uint32_t INTERNAL_NODE_MAX_CELLS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE - 1;
-const uint32_t INTERNAL_NODE_LEFT_SPLIT_COUNT = (INTERNAL_NODE_MAX_CELLS + 1) / 2;
-const uint32_t INTERNAL_NODE_RIGHT_SPLIT_COUNT = (INTERNAL_NODE_MAX_CELLS + 1) - INTERNAL_NODE_LEFT_SPLIT_COUNT;
-const uint32_t INTERNAL_NODE_MIN_CELLS = 1; // TODO: MODIFY IT AFTER TESTING
+const uint32_t INTERNAL_NODE_MAX_KEYS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CHILD_SIZE; // separators without suffixes
+const uint32_t INTERNAL_NODE_MIN_BYTES = INTERNAL_NODE_SPACE_FOR_CELLS / 3; // less than this underflows
 
 
 /* Leaf Node Fields Functions */
@@ -493,10 +1759,6 @@ void set_node_root (void* node, bool is_root) {
   *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
 }
 
-uint32_t* node_parent (void* node) {
-  return node + PARENT_POINTER_OFFSET;
-}
-
 /*---------------Leaf Node Functions ----------*/
 
 // given node, return ptr to its cell_num 
@@ -504,24 +1766,46 @@ uint32_t* leaf_node_num_cells (void* node) {
   return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
+// offset of the cell_num-th smallest key's cell
+uint16_t* leaf_node_slot (void* node, uint32_t cell_num) {
+  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
+}
+
 // given cell_num, return ptr to the cell in the leaf node.
 void* leaf_node_cell (void* node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+  return node + *leaf_node_slot(node, cell_num);
+}
+
+// bytes all keys of the leaf start with, the cells do not repeat them
+uint16_t* leaf_node_prefix_length (void* node) {
+  return node + LEAF_NODE_PREFIX_LENGTH_OFFSET;
+}
+
+char* leaf_node_prefix (void* node) {
+  return node + LEAF_NODE_PREFIX_OFFSET;
+}
+
+// bytes of each key kept in its cell
+uint32_t leaf_node_suffix_size (void* node) {
+  return LEAF_NODE_KEY_SIZE - *leaf_node_prefix_length(node);
 }
 
-// return ptr to cell's key according to cell_num
-char* leaf_node_key (void* node, uint32_t cell_num) {
+// return ptr to the stored part of cell's key according to cell_num
+char* leaf_node_key_suffix (void* node, uint32_t cell_num) {
   return (char*)leaf_node_cell(node, cell_num);
 }
 
-void set_leaf_node_key (void* node, uint32_t cell_num, char* key) {
-  char* dest = leaf_node_key(node, cell_num);
-  memcpy(dest, key, LEAF_NODE_KEY_SIZE);
+// copy the whole key of cell_num to key
+void leaf_node_get_key (void* node, uint32_t cell_num, char* key) {
+  uint32_t prefix_length = *leaf_node_prefix_length(node);
+  memcpy(key, leaf_node_prefix(node), prefix_length);
+  memcpy(key + prefix_length, leaf_node_key_suffix(node, cell_num), LEAF_NODE_KEY_SIZE - prefix_length);
 }
 
-// given cell_num, return ptr to cell's value, value = [key, value] here
-uint32_t* leaf_node_value (void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+bool leaf_node_key_equals (void* node, uint32_t cell_num, char* key) {
+  uint32_t prefix_length = *leaf_node_prefix_length(node);
+  return memcmp(key, leaf_node_prefix(node), prefix_length) == 0
+      && memcmp(key + prefix_length, leaf_node_key_suffix(node, cell_num), LEAF_NODE_KEY_SIZE - prefix_length) == 0;
 }
 
 // return leafnode's next leaf's page_id
@@ -529,40 +1813,231 @@ uint32_t* leaf_node_next_leaf(void* node) {
   return node + LEAF_NODE_NEXT_LEAF_SIZE_OFFSET;
 }
 
+// lowest byte used by posting lists, the heap grows downwards
+uint32_t* leaf_node_heap_start (void* node) {
+  return node + LEAF_NODE_HEAP_START_OFFSET;
+}
+
+uint16_t* leaf_node_posting_count (void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + leaf_node_suffix_size(node);
+}
+
+// values of the posting list, or the first overflow page's number if the list overflowed
+uint32_t* leaf_node_posting (void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + leaf_node_suffix_size(node) + LEAF_NODE_POSTING_COUNT_SIZE;
+}
+
+// bytes a posting list of count values takes in the heap
+uint32_t posting_size (uint16_t count) {
+  return count == POSTING_OVERFLOW ? sizeof(uint32_t) : count * LEAF_NODE_VALUE_SIZE;
+}
+
+// bytes a key takes in a leaf: its slot and its cell
+uint32_t leaf_cell_size (uint32_t suffix_size, uint16_t count) {
+  return LEAF_NODE_SLOT_SIZE + suffix_size + LEAF_NODE_POSTING_COUNT_SIZE + posting_size(count);
+}
+
+// contiguous free bytes between the slots and the heap
+uint32_t leaf_node_free_space (void* node) {
+  return *leaf_node_heap_start(node) - LEAF_NODE_HEADER_SIZE - *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+}
+
+// bytes used by slots and cells, without the holes left in the heap
+uint32_t leaf_node_used_bytes (void* node) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < num_cells; ++i) {
+    used += leaf_cell_size(leaf_node_suffix_size(node), *leaf_node_posting_count(node, i));
+  }
+  return used;
+}
+
+// take size bytes from the heap, the caller made sure they are free
+uint16_t leaf_node_heap_alloc (void* node, uint32_t size) {
+  *leaf_node_heap_start(node) -= size;
+  return *leaf_node_heap_start(node);
+}
+
+// empty the leaf, its keys will start with the first prefix_length bytes of key
+void leaf_node_set_prefix (void* node, char* key, uint32_t prefix_length) {
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_heap_start(node) = PAGE_SIZE;
+  *leaf_node_prefix_length(node) = prefix_length;
+  memcpy(leaf_node_prefix(node), key, prefix_length);
+}
+
+// add a key behind the largest one, its cell goes to the heap. key starts with the prefix
+void leaf_node_append_cell (void* node, char* key, uint16_t count, void* posting) {
+  uint32_t cell_num = *leaf_node_num_cells(node);
+  uint32_t suffix_size = leaf_node_suffix_size(node);
+  uint32_t size = posting_size(count);
+  *leaf_node_slot(node, cell_num) = leaf_node_heap_alloc(node, suffix_size + LEAF_NODE_POSTING_COUNT_SIZE + size);
+  memcpy(leaf_node_key_suffix(node, cell_num), key + *leaf_node_prefix_length(node), suffix_size);
+  *leaf_node_posting_count(node, cell_num) = count;
+  memcpy(leaf_node_posting(node, cell_num), posting, size);
+  *leaf_node_num_cells(node) = cell_num + 1;
+}
+
+/* shorten the prefix of the leaf until key starts with it, every cell grows by the bytes the prefix
+ * loses. an empty leaf takes all of key as its prefix. returns false and leaves the leaf alone if
+ * its cells would not fit anymore together with a new cell for key holding count values */
+bool leaf_node_take_prefix (void* node, char* key, uint16_t count) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t prefix_length = *leaf_node_prefix_length(node);
+  uint32_t common = key_common_prefix(key, leaf_node_prefix(node), prefix_length);
+  if (num_cells == 0) {
+    leaf_node_set_prefix(node, key, LEAF_NODE_KEY_SIZE);
+    return true;
+  }
+  if (common == prefix_length) {
+    return true;
+  }
+  uint32_t needed = leaf_node_used_bytes(node) + num_cells * (prefix_length - common) + leaf_cell_size(LEAF_NODE_KEY_SIZE - common, count);
+  if (needed > LEAF_NODE_SPACE_FOR_CELLS) {
+    return false;
+  }
+
+  char old_node[PAGE_SIZE];
+  memcpy(old_node, node, PAGE_SIZE);
+  leaf_node_set_prefix(node, key, common);
+  for (uint32_t i = 0; i < num_cells; ++i) {
+    char cell_key[LEAF_NODE_KEY_SIZE];
+    leaf_node_get_key(old_node, i, cell_key);
+    leaf_node_append_cell(node, cell_key, *leaf_node_posting_count(old_node, i), leaf_node_posting(old_node, i));
+  }
+  return true;
+}
+
+// the leaf holding the cell_num-th cell of left followed by right, cell_num becomes its index there
+void* leaf_pair_node (void* left, void* right, uint32_t* cell_num) {
+  uint32_t num_left = *leaf_node_num_cells(left);
+  if (*cell_num < num_left) {
+    return left;
+  }
+  *cell_num -= num_left;
+  return right;
+}
+
+// copy the key of the cell_num-th cell of left followed by right to key
+void leaf_pair_get_key (void* left, void* right, uint32_t cell_num, char* key) {
+  void* node = leaf_pair_node(left, right, &cell_num);
+  leaf_node_get_key(node, cell_num, key);
+}
+
+/* lay the cells of left and right out again: the first left_cells of them go to left, the rest to
+ * right (may be NULL). each leaf takes the longest prefix its keys share, and the holes in both
+ * heaps are dropped on the way, so repacking a single node compacts it */
+void leaf_node_repack (void* left, void* right, uint32_t left_cells) {
+  char old_left[PAGE_SIZE];
+  char old_right[PAGE_SIZE];
+  memcpy(old_left, left, PAGE_SIZE);
+  uint32_t num_cells = *leaf_node_num_cells(old_left);
+  if (right) {
+    memcpy(old_right, right, PAGE_SIZE);
+    num_cells += *leaf_node_num_cells(old_right);
+  }
+
+  void* destinations[2] = {left, right};
+  uint32_t ends[2] = {left_cells, num_cells};
+  uint32_t first = 0;
+  for (int32_t d = 0; d < 2 && destinations[d]; ++d) {
+    char first_key[12] = {0};
+    char last_key[12] = {0};
+    if (ends[d] > first) {
+      leaf_pair_get_key(old_left, old_right, first, first_key);
+      leaf_pair_get_key(old_left, old_right, ends[d] - 1, last_key);
+    }
+    leaf_node_set_prefix(destinations[d], first_key, key_common_prefix(first_key, last_key, LEAF_NODE_KEY_SIZE));
+
+    for (uint32_t i = first; i < ends[d]; ++i) {
+      uint32_t cell_num = i;
+      void* source = leaf_pair_node(old_left, old_right, &cell_num);
+      char key[LEAF_NODE_KEY_SIZE];
+      leaf_node_get_key(source, cell_num, key);
+      leaf_node_append_cell(destinations[d], key, *leaf_node_posting_count(source, cell_num), leaf_node_posting(source, cell_num));
+    }
+    first = ends[d];
+  }
+}
+
+/* number of cells of left followed by right that left keeps when the two share them out evenly:
+ * the fuller one holds as few bytes as possible. a leaf's keys are as long as the bytes its
+ * first and last key do not share */
+uint32_t leaf_node_even_split (void* left, void* right) {
+  uint32_t num_cells = *leaf_node_num_cells(left) + *leaf_node_num_cells(right);
+  char keys[num_cells][LEAF_NODE_KEY_SIZE];
+  uint32_t bytes[num_cells + 1]; // bytes of the cells in front of i, without their keys
+  bytes[0] = 0;
+  for (uint32_t i = 0; i < num_cells; ++i) {
+    uint32_t cell_num = i;
+    void* node = leaf_pair_node(left, right, &cell_num);
+    leaf_node_get_key(node, cell_num, keys[i]);
+    bytes[i + 1] = bytes[i] + leaf_cell_size(0, *leaf_node_posting_count(node, cell_num));
+  }
+
+  uint32_t best_cells = 1;
+  uint32_t best_bytes = UINT32_MAX;
+  for (uint32_t m = 1; m < num_cells; ++m) {
+    uint32_t left_bytes = bytes[m] + m * (LEAF_NODE_KEY_SIZE - key_common_prefix(keys[0], keys[m - 1], LEAF_NODE_KEY_SIZE));
+    uint32_t right_bytes = bytes[num_cells] - bytes[m]
+                         + (num_cells - m) * (LEAF_NODE_KEY_SIZE - key_common_prefix(keys[m], keys[num_cells - 1], LEAF_NODE_KEY_SIZE));
+    uint32_t fuller = left_bytes > right_bytes ? left_bytes : right_bytes;
+    if (fuller < best_bytes) {
+      best_cells = m;
+      best_bytes = fuller;
+    }
+  }
+  return best_cells;
+}
+
+// bytes the cells of left and right would use in one leaf
+uint32_t leaf_node_merged_bytes (void* left, void* right) {
+  uint32_t num_cells = *leaf_node_num_cells(left) + *leaf_node_num_cells(right);
+  if (num_cells == 0) {
+    return 0;
+  }
+  char first_key[LEAF_NODE_KEY_SIZE];
+  char last_key[LEAF_NODE_KEY_SIZE];
+  leaf_pair_get_key(left, right, 0, first_key);
+  leaf_pair_get_key(left, right, num_cells - 1, last_key);
+  uint32_t suffix_size = LEAF_NODE_KEY_SIZE - key_common_prefix(first_key, last_key, LEAF_NODE_KEY_SIZE);
+
+  uint32_t bytes = 0;
+  for (uint32_t i = 0; i < num_cells; ++i) {
+    uint32_t cell_num = i;
+    void* node = leaf_pair_node(left, right, &cell_num);
+    bytes += leaf_cell_size(suffix_size, *leaf_node_posting_count(node, cell_num));
+  }
+  return bytes;
+}
+
 /** @params: void* node
  *  return: index of given key in the node, if contains several keys,
- *          return the minimum index.
+ *          return the minimum index. (number of cells if all keys are smaller)
  */ 
 uint32_t leaf_node_find_key_index (void* node, char* key) {
-  uint32_t min_index = 0;
-  uint32_t max_index = *leaf_node_num_cells(node);
+  // a key outside the prefix is smaller or larger than all keys of the leaf
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t prefix_length = *leaf_node_prefix_length(node);
+  int cmp = key_prefix_compare(key, leaf_node_prefix(node), prefix_length);
+  if (cmp != 0) {
+    return cmp < 0 ? 0 : num_cells;
+  }
 
+  // suffixes end where the keys do, their windows are the last suffix_size bytes.
+  // comparing the last candidates at once with gathered windows (AVX2) measured no faster
+  uint32_t suffix_size = LEAF_NODE_KEY_SIZE - prefix_length;
+  KeyWindow window;
+  key_window_init(&window, key, prefix_length, suffix_size);
+  uint32_t min_index = 0;
+  uint32_t max_index = num_cells;
   while (min_index != max_index) {
     uint32_t mid_index = (min_index + max_index) / 2;
-    char* key_at_mid_index = leaf_node_key(node, mid_index);
-    int cmp = strcmp(key, key_at_mid_index);
-
-    if (cmp == 0) {
-      int32_t test_index = mid_index;
-      while (test_index >= 0){
-        /* code */
-        int test_cmp = strcmp(key, leaf_node_key(node, test_index));
-        if (test_cmp) {
-          break;
-        }
-        else {
-          --test_index;
-        }
-      }
-      min_index = test_index + 1;
-      break;
-    }
-    else if (cmp > 0) {
-      // key is larger than mid_key
-      max_index = mid_index;
+    if (key_window_compare(&window, leaf_node_key_suffix(node, mid_index) + suffix_size) < 0) {
+      min_index = mid_index + 1;
     }
     else {
-      min_index = mid_index + 1;
+      max_index = mid_index;
     }
   }
   return min_index;
@@ -582,8 +2057,22 @@ uint32_t* internal_node_right_child (void* node) {
   return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
+// bytes all separators of the node start with, the cells do not repeat them
+uint16_t* internal_node_prefix_length (void* node) {
+  return node + INTERNAL_NODE_PREFIX_LENGTH_OFFSET;
+}
+
+// bytes of each separator kept in its cell, the ones behind them are zero
+uint16_t* internal_node_suffix_size (void* node) {
+  return node + INTERNAL_NODE_SUFFIX_SIZE_OFFSET;
+}
+
+char* internal_node_prefix (void* node) {
+  return node + INTERNAL_NODE_PREFIX_OFFSET;
+}
+
 void* internal_node_cell (void* node, uint32_t cell_num) {
-  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * (INTERNAL_NODE_CHILD_SIZE + *internal_node_suffix_size(node));
 }
 
 uint32_t* internal_node_child (void* node, uint32_t child_num) {
@@ -598,22 +2087,100 @@ uint32_t* internal_node_child (void* node, uint32_t child_num) {
   }
 }
 
-char* internal_node_key (void* node, uint32_t key_num) {
+char* internal_node_key_suffix (void* node, uint32_t key_num) {
   return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
-char* get_node_max_key(void* node) {
-  switch (get_node_type(node)) {
-    case NODE_INTERNAL:
-      return internal_node_key(node, *internal_node_num_keys(node) - 1);
-    case NODE_LEAF:
-      return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// copy the whole separator key_num to key
+void internal_node_get_key (void* node, uint32_t key_num, char* key) {
+  uint32_t prefix_length = *internal_node_prefix_length(node);
+  uint32_t suffix_size = *internal_node_suffix_size(node);
+  memset(key, 0, INTERNAL_NODE_KEY_SIZE);
+  memcpy(key, internal_node_prefix(node), prefix_length);
+  memcpy(key + prefix_length, internal_node_key_suffix(node, key_num), suffix_size);
+}
+
+uint32_t internal_node_used_bytes (void* node) {
+  return *internal_node_num_keys(node) * (INTERNAL_NODE_CHILD_SIZE + *internal_node_suffix_size(node));
+}
+
+/* Internal nodes are changed on unpacked copies: whole separators and all children in two arrays,
+ * children[num_keys] is the rightmost child. packing them picks the prefix and the cell width again */
+
+// bytes of a cell for num_keys sorted separators, and the prefix they share
+uint32_t internal_node_packed_cell_size (char (*keys)[12], uint32_t num_keys, uint32_t* prefix_length) {
+  uint32_t longest = 0;
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    uint32_t length = key_length(keys[i]);
+    longest = length > longest ? length : longest;
+  }
+  *prefix_length = num_keys == 0 ? 0 : key_common_prefix(keys[0], keys[num_keys - 1], INTERNAL_NODE_KEY_SIZE);
+  return INTERNAL_NODE_CHILD_SIZE + (longest > *prefix_length ? longest - *prefix_length : 0);
+}
+
+uint32_t internal_node_packed_bytes (char (*keys)[12], uint32_t num_keys) {
+  uint32_t prefix_length;
+  return num_keys * internal_node_packed_cell_size(keys, num_keys, &prefix_length);
+}
+
+// returns the number of separators
+uint32_t internal_node_unpack (void* node, uint32_t* children, char (*keys)[12]) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    children[i] = *internal_node_child(node, i);
+    internal_node_get_key(node, i, keys[i]);
+  }
+  children[num_keys] = *internal_node_right_child(node);
+  return num_keys;
+}
+
+// the caller made sure they fit
+void internal_node_pack (void* node, uint32_t* children, char (*keys)[12], uint32_t num_keys) {
+  uint32_t prefix_length;
+  uint32_t cell_size = internal_node_packed_cell_size(keys, num_keys, &prefix_length);
+  *internal_node_num_keys(node) = num_keys;
+  *internal_node_prefix_length(node) = prefix_length;
+  *internal_node_suffix_size(node) = cell_size - INTERNAL_NODE_CHILD_SIZE;
+  if (num_keys > 0) {
+    memcpy(internal_node_prefix(node), keys[0], prefix_length);
   }
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    *internal_node_child(node, i) = children[i];
+    memcpy(internal_node_key_suffix(node, i), keys[i] + prefix_length, cell_size - INTERNAL_NODE_CHILD_SIZE);
+  }
+  *internal_node_right_child(node) = children[num_keys];
 }
 
-void update_internal_node_key (void* node, char* old_key, char* new_key) {
-  uint32_t old_child_index = internal_node_find_child(node, old_key);
-  memcpy(internal_node_key(node, old_child_index), new_key, 12);
+/* where to cut num_keys separators in two nodes: the first `returned` ones stay left, the next goes up,
+ * the rest go right. the fuller node gets as few bytes as possible, a node's cells are as wide
+ * as its longest separator is behind the prefix of its first and last one */
+uint32_t internal_node_even_split (char (*keys)[12], uint32_t num_keys) {
+  uint32_t longest_left[num_keys]; // longest of keys[0..i]
+  uint32_t longest_right[num_keys + 1]; // longest of keys[i..num_keys)
+  longest_right[num_keys] = 0;
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    uint32_t length = key_length(keys[i]);
+    longest_left[i] = (i > 0 && longest_left[i - 1] > length) ? longest_left[i - 1] : length;
+  }
+  for (uint32_t i = num_keys; i > 0; --i) {
+    uint32_t length = key_length(keys[i - 1]);
+    longest_right[i - 1] = longest_right[i] > length ? longest_right[i] : length;
+  }
+
+  uint32_t best_keys = num_keys / 2;
+  uint32_t best_bytes = UINT32_MAX;
+  for (uint32_t m = 1; m + 1 < num_keys; ++m) {
+    uint32_t left_prefix = key_common_prefix(keys[0], keys[m - 1], INTERNAL_NODE_KEY_SIZE);
+    uint32_t right_prefix = key_common_prefix(keys[m + 1], keys[num_keys - 1], INTERNAL_NODE_KEY_SIZE);
+    uint32_t left_bytes = m * (INTERNAL_NODE_CHILD_SIZE + (longest_left[m - 1] > left_prefix ? longest_left[m - 1] - left_prefix : 0));
+    uint32_t right_bytes = (num_keys - m - 1) * (INTERNAL_NODE_CHILD_SIZE + (longest_right[m + 1] > right_prefix ? longest_right[m + 1] - right_prefix : 0));
+    uint32_t fuller = left_bytes > right_bytes ? left_bytes : right_bytes;
+    if (fuller < best_bytes) {
+      best_keys = m;
+      best_bytes = fuller;
+    }
+  }
+  return best_keys;
 }
 
 // find child's page_id with given key(varchar) in an internal node
@@ -629,36 +2196,31 @@ uint32_t internal_node_find_child (void* node, char* key) {
     printf("Error! You've entered an Empty Page!!!\n");
     exit(EXIT_FAILURE);
   }
+  // a key outside the prefix goes to the first or the rightmost child
+  uint32_t prefix_length = *internal_node_prefix_length(node);
+  int cmp = key_prefix_compare(key, internal_node_prefix(node), prefix_length);
+  if (cmp != 0) {
+    return cmp < 0 ? 0 : num_keys;
+  }
+
+  // first index where [key <= separator], num_keys means the right child.
+  // separators end with their suffixes, a key going on behind an equal suffix is larger
+  uint32_t suffix_size = *internal_node_suffix_size(node);
+  bool longer = key_length(key) > prefix_length + suffix_size;
+  KeyWindow window;
+  key_window_init(&window, key, prefix_length, suffix_size);
   uint32_t min_index = 0;
   uint32_t max_index = num_keys;
-
   while (min_index != max_index) {
-    // find the index where [index <= key]
-    uint32_t index = (min_index + max_index) / 2;
-    char key_to_compare[12];
-    memcpy(key_to_compare, internal_node_key(node, index), 12);
-    int cmp = strcmp(key, key_to_compare);
-
-    if (cmp == 0) {
-      int32_t test_index = index;
-      while (test_index >= 0) {
-        char* same_key = internal_node_key(node, test_index);
-        if (strcmp(key, same_key) != 0) {
-          break;
-        } else {
-          --test_index;
-        }
-      }
-      min_index = test_index + 1;
-      break;
+    uint32_t mid_index = (min_index + max_index) / 2;
+    int c = key_window_compare(&window, internal_node_key_suffix(node, mid_index) + suffix_size);
+    if (c < 0 || (c == 0 && longer)) {
+      min_index = mid_index + 1;
+    }
+    else {
+      max_index = mid_index;
     }
-    else if (cmp < 0) { // current key is smaller than spotted key
-      max_index = index;
-    } else {
-      min_index = index + 1;
-    }      
   }
-
   return min_index;
 }
 
@@ -674,6 +2236,8 @@ void initialize_leaf_node (void* node) {
   set_node_root(node, false);
   *leaf_node_num_cells(node) = 0;
   *leaf_node_next_leaf(node) = 0;
+  *leaf_node_heap_start(node) = PAGE_SIZE;
+  *leaf_node_prefix_length(node) = 0;
 }
 
 // initializer an internal node
@@ -681,7 +2245,16 @@ void initialize_internal_node (void* node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
+  *internal_node_prefix_length(node) = 0;
+  *internal_node_suffix_size(node) = 0;
+}
 
+// initialize an overflow page of a posting list
+void initialize_overflow_node (void* node) {
+  set_node_type(node, NODE_OVERFLOW);
+  set_node_root(node, false);
+  *(uint32_t*)(node + OVERFLOW_NODE_NEXT_OFFSET) = 0;
+  *(uint32_t*)(node + OVERFLOW_NODE_NUM_VALUES_OFFSET) = 0;
 }
 
 // 测试用: 打印B+树内部的节点信息
@@ -690,8 +2263,10 @@ void print_internal_node_info (void* node, uint32_t id) {
   printf("Internal Node, Page: [%d]\n", id);
 
   for (int32_t i = 0; i < num_keys; ++i) {
+    char key[13] = {0};
+    internal_node_get_key(node, i, key);
     printf("--> Child Node, Page: [%d]\n", *internal_node_child(node, i));
-    printf("--> Key %d: %s\n", i, internal_node_key(node, i));
+    printf("--> Key %d: %s\n", i, key);
   }
   printf("--> Rightmost Child Node, Page: [%d]\n", *internal_node_right_child(node));
 }
@@ -700,1058 +2275,1502 @@ void print_internal_node_info (void* node, uint32_t id) {
 
 
 
-/* B-Tree operations */
-
-/* the key to select is stored in `statement.row.b` */
-void b_tree_search() {
-  /* print selected rows */
-  Row row;
-  char* key_to_find = statement.row.b;
-  Cursor* cursor = table_find(table, key_to_find);
-  int32_t counter = 0;
+/*---------- Free Page List --------------*/
 
-  while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    if (strcmp(row.b, statement.row.b) != 0) {
-      break;
-    } else {
-      print_row(&row);
-      cursor_advance(cursor);
-      ++counter;
-    }
-  }
+/* Pages dropped by merges form a linked list whose head is saved in the
+ * header page, they are handed out again before the file grows. */
 
-  if (counter == 0) {
-    printf("(Empty)\n");
-  }
-  return;
+// next page on the free list, stored right behind the common header
+uint32_t* free_page_next (void* node) {
+  return node + COMMON_NODE_HEADER_SIZE;
 }
 
-/* 初次分裂才会调用这个函数, 生成一个新的根节点!!!
-*/
-void create_new_root(Table* table, uint32_t right_child_page_num) {
-  // printf("Creating New Root! Page NO is %d\n", right_child_page_num);
+// put a page nobody points at anymore onto the free list
+void free_page (Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  mark_page_dirty(pager, page_num);
+  memset(node, 0, PAGE_SIZE);
+  set_node_type(node, NODE_FREE);
+  *free_page_next(node) = pager->free_head;
+  pager->free_head = page_num;
+  unpin_page(pager, page_num);
+}
 
-  void* root = get_page(table->pager, table->root_page_num);
-  void* right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void* left_child = get_page(table->pager, left_child_page_num);
-  memset(left_child, 0, PAGE_SIZE);
+// take a page from the free list, or append a new one to the file
+// the page comes back zeroed and unpinned
+uint32_t get_unused_page_num (Pager* pager) {
+  uint32_t page_num = pager->free_head;
+  if (page_num == 0) {
+    page_num = pager->num_pages;
+  }
 
-  // printf("Left child's page_id is: %d\n", left_child_page_num);
+  void* node = get_page(pager, page_num); // grows num_pages for a new page
+  mark_page_dirty(pager, page_num);
+  if (page_num == pager->free_head) {
+    pager->free_head = *free_page_next(node);
+  }
+  memset(node, 0, PAGE_SIZE);
+  unpin_page(pager, page_num);
+  return page_num;
+}
 
-  /* Left child has data copied from old root */
-  memcpy(left_child, root, PAGE_SIZE);
-  set_node_root(left_child, false);
+/*---------------------------------------------*/
 
-  /* Root node is a new internal node with one key and two children */
-  initialize_internal_node(root);
-  set_node_root(root, true);
-  *internal_node_num_keys(root) = 1; // actually is 1 + (rightmost child) 1 = 2
-  *internal_node_child(root, 0) = left_child_page_num;
-
-  // get maxchild string in the leftchild page
-  char* left_child_max_key = get_node_max_key(left_child);
-  char* key_to_be_set = internal_node_key(root, 0);
-
-  memcpy(key_to_be_set, left_child_max_key, 12);
-
-  *internal_node_right_child(root) = right_child_page_num;
-  *node_parent(left_child) = table->root_page_num;
-  *node_parent(right_child) = table->root_page_num;
-  // printf("Left child page_id: %d, Right child page_id: %d\n", left_child_page_num, right_child_page_num);
-}
-
-// 上层内部节点的分裂 & 插入父节点的一些操作函数
-void insert_into_parent(Table* table, uint32_t old_left_page_id, uint32_t old_right_page_id, char* key_to_liftup) {
-  // 1. 分裂过的内部节点是原先的根节点
-  if (old_left_page_id == table->root_page_num) {
-    // printf("Called Here\n");
-    uint32_t new_left_child_id = get_unused_page_num(table->pager);
-    void* new_left_child_page = get_page(table->pager, new_left_child_id);
-    void* root = get_page(table->pager, table->root_page_num);
-    memcpy(new_left_child_page, root, PAGE_SIZE);
-    set_node_type(new_left_child_page, NODE_INTERNAL);
-    set_node_root(new_left_child_page, false);
-
-    initialize_internal_node(root);
-    set_node_root(root, true);
-    *internal_node_num_keys(root) = 1; // actually is 1 + (rightmost child) 1 = 2
-    *internal_node_child(root, 0) = new_left_child_id;
-    *internal_node_right_child(root) = old_right_page_id;
-
-    char* key_to_be_set = internal_node_key(root, 0);
-    memcpy(key_to_be_set, key_to_liftup, INTERNAL_NODE_KEY_SIZE);
-    // printf("And String: %s will be set as the first key in the root node!\n", key_to_be_set);
-
-    // 完成 子节点 与叶子节点之间的连接 
-    *node_parent(new_left_child_page) = table->root_page_num;
-    for (int32_t i = 0; i < *internal_node_num_keys(new_left_child_page); ++i) {
-      void* child_page = get_page(table->pager, *internal_node_child(new_left_child_page, i));
-      // printf("Child id %d\n", *internal_node_child(new_left_child_page, i));
-      *node_parent(child_page) = new_left_child_id;
-    }
-    void* rightmost_child_page = get_page(table->pager, *internal_node_right_child(new_left_child_page));
-
-    // printf("Rightmost Child id %d\n", *internal_node_right_child(new_left_child_page));
-    *node_parent(rightmost_child_page) = new_left_child_id;
-    
-    // 拿到右孩子页面
-    void* new_right_child_page = get_page(table->pager, old_right_page_id);
-    *node_parent(new_right_child_page) = table->root_page_num;
-
-    // printf("Left child page_id: %d, Right child page_id: %d\n", new_left_child_id, old_right_page_id);
-    // printf("OK, have inserted into parent: %s\n", key_to_liftup);
-    return;
-  }
-  else {
-    // 分裂过的节点并不是根节点
-    void* old_left_page = get_page(table->pager, old_left_page_id);
-    uint32_t parent_of_old_id = *node_parent(old_left_page);
-    void* parent_of_old_page = get_page(table->pager, parent_of_old_id);
-    uint32_t num_keys_in_parent = *internal_node_num_keys(parent_of_old_page);
-
-    if (num_keys_in_parent <= INTERNAL_NODE_MAX_CELLS - 1) {
-      // printf("Parent Not Full! Normal Insert\n");
-
-      uint32_t index = internal_node_find_child(parent_of_old_page, key_to_liftup);
-      uint32_t rightmost_id_in_parent = *internal_node_right_child(parent_of_old_page);
-      void* rightmost_child = get_page(table->pager, rightmost_id_in_parent);
-      char* parent_max_key = get_node_max_key(parent_of_old_page);
-      
-      // print_internal_node_info(parent_of_old_page, parent_of_old_id);
-
-      if (strcmp(key_to_liftup, parent_max_key) >= 0) {
-        // 最大! 更新最右指针, 将原来的移到内部
-        // printf("Old Max Child is %d\n", *internal_node_right_child(parent_of_old_page));
-        *internal_node_num_keys(parent_of_old_page) = num_keys_in_parent + 1;
-
-        *internal_node_child(parent_of_old_page, num_keys_in_parent) = *internal_node_right_child(parent_of_old_page);
-        // printf("Mid Key Ptr: %d, Num keys = %d\n", *internal_node_child(parent_of_old_page, num_keys_in_parent), num_keys_in_parent);
-        memcpy(internal_node_key(parent_of_old_page, num_keys_in_parent), key_to_liftup, INTERNAL_NODE_KEY_SIZE);
-        // 然后将提升的键存入
-        *internal_node_right_child(parent_of_old_page) = old_right_page_id;
-        
-        // only node appended, so update only one child pointer
-        void* updated_rightmost_node = get_page(table->pager, old_right_page_id);
-        *node_parent(updated_rightmost_node) = parent_of_old_id;
-      } 
-      else {
-        // 不是最大的!
-        for (int32_t i = num_keys_in_parent; i > index; --i) {
-          void* dest = internal_node_cell(parent_of_old_page, i);
-          void* src = internal_node_cell(parent_of_old_page, i - 1);
-          memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_child(parent_of_old_page, index) = old_left_page_id;
-        *node_parent(old_left_page) = parent_of_old_id; // 更新子节点的指针指向
 
-        memcpy(internal_node_key(parent_of_old_page, index), key_to_liftup, 12);   
-        *internal_node_child(parent_of_old_page, index + 1) = old_right_page_id;    
-        
-        void* old_right_page = get_page(table->pager, old_right_page_id);
-        *node_parent(old_right_page) = parent_of_old_id; // 更新子节点的指针指向
 
-        *internal_node_num_keys(parent_of_old_page) = num_keys_in_parent + 1;
-      }
+/*---------- Posting Lists --------------*/
 
-      // print_internal_node_info(parent_of_old_page, parent_of_old_id);
-      return;
-    }
-    else {
-      // 否则做分裂, 再递归调用
-      uint32_t key_to_liftup_index = internal_node_find_child(parent_of_old_page, key_to_liftup); // 之前页面溢出的key 在它父结点中对应的位置是什么
-
-      // 特殊! 当前 已满的父结点是根节点的情况! 直接新建一个根, 并分裂, CHECKED
-      if (parent_of_old_id == 0) {
-        // printf("Splitting Root!!\n");
-        uint32_t new_left_part_id = get_unused_page_num(table->pager);
-        void* new_left_part_root = get_page(table->pager, new_left_part_id);
-        uint32_t new_right_part_id = get_unused_page_num(table->pager);
-        void* new_right_part_root = get_page(table->pager, new_right_part_id);
-
-        initialize_internal_node(new_left_part_root);
-        initialize_internal_node(new_right_part_root);
-        *internal_node_num_keys(parent_of_old_page) = num_keys_in_parent + 1; 
-
-        if (key_to_liftup_index >= num_keys_in_parent) {
-          // 加入的key是最大的, 需要修改rightmost信息
-          uint32_t original_rightmost_child_id = *internal_node_right_child(parent_of_old_page);
-          *internal_node_child(parent_of_old_page, num_keys_in_parent) = original_rightmost_child_id;
-          memcpy(internal_node_key(parent_of_old_page, num_keys_in_parent), key_to_liftup, INTERNAL_NODE_KEY_SIZE); // | P(N-1) | K(N) | ... | rightmost
-          *internal_node_right_child(parent_of_old_page) = old_right_page_id;
-        }
-        else {
-          for (int32_t i = num_keys_in_parent; i > key_to_liftup_index; --i) {
-            void* dest = internal_node_cell(parent_of_old_page, i);
-            void* src = internal_node_cell(parent_of_old_page, i - 1);
-            memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
-          }
-          *internal_node_child(parent_of_old_page, key_to_liftup_index) = old_left_page_id;
-          memcpy(internal_node_key(parent_of_old_page, key_to_liftup_index), key_to_liftup, 12);    
-          *internal_node_child(parent_of_old_page, key_to_liftup_index + 1) = old_right_page_id;    
-        }
-        
-        int temp = *internal_node_num_keys(parent_of_old_page);
-        *internal_node_num_keys(new_left_part_root) = (temp - 1) / 2;
-        *internal_node_num_keys(new_right_part_root) = (temp - 1) - *internal_node_num_keys(new_left_part_root);
-
-        uint32_t left_part_root_num_cells = *internal_node_num_keys(new_left_part_root);
-        uint32_t right_part_root_num_cells = *internal_node_num_keys(new_right_part_root);
-        int32_t mid = left_part_root_num_cells; 
-        char mid_key[12];
-        memcpy(mid_key, internal_node_key(parent_of_old_page, mid), INTERNAL_NODE_KEY_SIZE);
-
-        for (int i = 0; i < left_part_root_num_cells; ++i) {
-          memcpy(internal_node_cell(new_left_part_root, i), internal_node_cell(parent_of_old_page, i), INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_right_child(new_left_part_root) = *internal_node_child(parent_of_old_page, left_part_root_num_cells);
+/* The `a` values of one key, kept in the leaf next to the key (newest first) until there are
+ * more than LEAF_NODE_MAX_POSTING of them, then in a chain of overflow pages. */
 
-        for (int i = 0; i < right_part_root_num_cells; ++i) {
-          memcpy(internal_node_cell(new_right_part_root, i), internal_node_cell(parent_of_old_page, i + left_part_root_num_cells + 1), INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_right_child(new_right_part_root) = *internal_node_right_child(parent_of_old_page);
+// next (older) overflow page of the list, 0 at the end
+uint32_t* overflow_node_next (void* node) {
+  return node + OVERFLOW_NODE_NEXT_OFFSET;
+}
 
-        for (int i = 0; i < left_part_root_num_cells; ++i) {
-          void* c = get_page(table->pager, *internal_node_child(new_left_part_root, i));
-          *node_parent(c) = new_left_part_id;
-        }
-        void* rm = get_page(table->pager, *internal_node_right_child(new_left_part_root));
-        *node_parent(rm) = new_left_part_id;
+uint32_t* overflow_node_num_values (void* node) {
+  return node + OVERFLOW_NODE_NUM_VALUES_OFFSET;
+}
 
-        for (int i = 0; i < right_part_root_num_cells; ++i) {
-          void* c = get_page(table->pager, *internal_node_child(new_right_part_root, i));
-          *node_parent(c) = new_right_part_id;
-        }
-        rm = get_page(table->pager, *internal_node_right_child(new_right_part_root));
-        *node_parent(rm) = new_right_part_id;
+uint32_t* overflow_node_value (void* node, uint32_t value_num) {
+  return node + OVERFLOW_NODE_HEADER_SIZE + value_num * LEAF_NODE_VALUE_SIZE;
+}
 
-        initialize_internal_node(parent_of_old_page);
-        set_node_root(parent_of_old_page, true);
-        *internal_node_num_keys(parent_of_old_page) = 1; 
-        *internal_node_child(parent_of_old_page, 0) = new_left_part_id;
-        *internal_node_right_child(parent_of_old_page) = new_right_part_id;
+// add value to the list starting at overflow page head, returns the (possibly new) head
+uint32_t overflow_append (Pager* pager, uint32_t head, uint32_t value) {
+  void* node = get_page(pager, head);
+  uint32_t num_values = *overflow_node_num_values(node);
+  if (num_values == OVERFLOW_NODE_MAX_VALUES) {
+    // head page is full, a new page goes in front of it
+    unpin_page(pager, head);
+    uint32_t new_head = get_unused_page_num(pager);
+    node = get_page(pager, new_head);
+    initialize_overflow_node(node);
+    *overflow_node_next(node) = head;
+    head = new_head;
+    num_values = 0;
+  }
+  mark_page_dirty(pager, head);
+  *overflow_node_value(node, num_values) = value;
+  *overflow_node_num_values(node) = num_values + 1;
+  unpin_page(pager, head);
+  return head;
+}
 
-        char* key_to_be_set = internal_node_key(parent_of_old_page, 0);
-        memcpy(key_to_be_set, mid_key, 12);
+// move the full posting list of cell_num into a new overflow page, returns its page number
+uint32_t posting_spill (Pager* pager, void* node, uint32_t cell_num) {
+  uint32_t count = *leaf_node_posting_count(node, cell_num);
+  uint32_t* values = leaf_node_posting(node, cell_num);
+  uint32_t page_num = get_unused_page_num(pager);
+  void* overflow = get_page(pager, page_num);
+  mark_page_dirty(pager, page_num);
+  initialize_overflow_node(overflow);
+  for (uint32_t i = 0; i < count; ++i) {
+    // the leaf keeps the newest value first, overflow pages the oldest
+    *overflow_node_value(overflow, i) = values[count - 1 - i];
+  }
+  *overflow_node_num_values(overflow) = count;
+  unpin_page(pager, page_num);
+  return page_num;
+}
 
-        *node_parent(new_left_part_root) = parent_of_old_id;
-        *node_parent(new_right_part_root) = parent_of_old_id;
-        return;
-      }
+/* called with the whole key of a cell and one value of its posting list, arg is passed through */
+typedef void (*PostingVisitor) (char* key, uint32_t value, void* arg);
+
+// call visit for the values of cell_num, newest first, returns how many there were
+uint32_t posting_for_each (Pager* pager, void* node, uint32_t cell_num, PostingVisitor visit, void* arg) {
+  char key[12];
+  leaf_node_get_key(node, cell_num, key);
+  uint16_t count = *leaf_node_posting_count(node, cell_num);
+  uint32_t* values = leaf_node_posting(node, cell_num);
+  if (count != POSTING_OVERFLOW) {
+    for (uint32_t i = 0; i < count; ++i) {
+      visit(key, values[i], arg);
+    }
+    return count;
+  }
 
-      // 否则, 分裂内部的父结点, 并将分裂后的两个页面ID 和 新产生键传递给它的父结点
-      uint32_t right_part_id = get_unused_page_num(table->pager); // 分裂之后的右半页面ID
-      void* right_part_page = get_page(table->pager, right_part_id); // 分裂之后的右半页面
+  uint32_t visited = 0;
+  uint32_t page_num = *values;
+  while (page_num != 0) {
+    void* overflow = get_page(pager, page_num);
+    for (uint32_t i = *overflow_node_num_values(overflow); i > 0; --i) {
+      visit(key, *overflow_node_value(overflow, i - 1), arg);
+    }
+    visited += *overflow_node_num_values(overflow);
+    uint32_t next_page_num = *overflow_node_next(overflow);
+    unpin_page(pager, page_num);
+    page_num = next_page_num;
+  }
+  return visited;
+}
 
-      // print_internal_node_info(parent_of_old_page, parent_of_old_id);
+// a row of the table: the key is column b, the value column a
+void print_table_row (char* key, uint32_t value, void* arg) {
+  (void)arg;
+  Row row;
+  row.a = value;
+  memcpy(row.b, key, sizeof(row.b));
+  print_row(&row);
+}
 
-      *internal_node_num_keys(parent_of_old_page) = num_keys_in_parent + 1; 
+// print the rows of cell_num, newest first, returns how many there were
+uint32_t posting_print_rows (Pager* pager, void* node, uint32_t cell_num) {
+  return posting_for_each(pager, node, cell_num, print_table_row, NULL);
+}
 
-      // 先假装不会发生溢出, 选择合适的位置插入相关的key, 更新与之对应的子页面指针
-      if (key_to_liftup_index >= num_keys_in_parent) {
-        // 加入的key是最大的, 需要修改rightmost信息
-        uint32_t original_rightmost_child_id = *internal_node_right_child(parent_of_old_page);
-        *internal_node_child(parent_of_old_page, num_keys_in_parent) = original_rightmost_child_id;
-        memcpy(internal_node_key(parent_of_old_page, num_keys_in_parent), key_to_liftup, INTERNAL_NODE_KEY_SIZE); // | P(N-1) | K(N) | ... | rightmost
-        *internal_node_right_child(parent_of_old_page) = old_right_page_id;
-      }
-      else {
-        for (int32_t i = num_keys_in_parent; i > key_to_liftup_index; --i) {
-          void* dest = internal_node_cell(parent_of_old_page, i);
-          void* src = internal_node_cell(parent_of_old_page, i - 1);
-          memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_child(parent_of_old_page, key_to_liftup_index) = old_left_page_id;
-        memcpy(internal_node_key(parent_of_old_page, key_to_liftup_index), key_to_liftup, 12);    
-        *internal_node_child(parent_of_old_page, key_to_liftup_index + 1) = old_right_page_id;    
-      }
+// give the overflow pages of cell_num back, returns the number of values the list held
+uint32_t posting_free (Pager* pager, void* node, uint32_t cell_num) {
+  uint16_t count = *leaf_node_posting_count(node, cell_num);
+  if (count != POSTING_OVERFLOW) {
+    return count;
+  }
 
-      uint32_t mid_liftup_index = (num_keys_in_parent + 1) / 2; // 插入之间溢出键后, 父结点发生溢出, 相应产生的键是什么, 索引是什么
-      char* key_to_liftup_by_old_parent = internal_node_key(parent_of_old_page, mid_liftup_index);
-      uint32_t reserved_child_for_leftpart = *internal_node_child(parent_of_old_page, mid_liftup_index);
+  uint32_t freed = 0;
+  uint32_t page_num = *leaf_node_posting(node, cell_num);
+  while (page_num != 0) {
+    void* overflow = get_page(pager, page_num);
+    freed += *overflow_node_num_values(overflow);
+    uint32_t next_page_num = *overflow_node_next(overflow);
+    unpin_page(pager, page_num);
+    free_page(pager, page_num);
+    page_num = next_page_num;
+  }
+  return freed;
+}
 
-      // 更新新分裂内部节点的键数量
-      *internal_node_num_keys(right_part_page) = (num_keys_in_parent) / 2;
-      int32_t right_part_size = *internal_node_num_keys(right_part_page);
-      int32_t left_part_size = num_keys_in_parent - right_part_size;
-      // printf("Parent Size %d, Left Size %d, Right Size %d\n", num_keys_in_parent + 1, left_part_size, right_part_size);
-      // printf("Key to be lifted will be %s\n", key_to_liftup_by_old_parent);
+/*---------------------------------------------*/
 
-      for (int32_t i = 0; i < right_part_size; ++i) {
-        memcpy(internal_node_cell(right_part_page, i), internal_node_cell(parent_of_old_page, left_part_size + i + 1), INTERNAL_NODE_CELL_SIZE);
-      }
 
-      // 更新子节点的指针信息
-      // 最右指针更新
-      *internal_node_right_child(right_part_page) = *internal_node_right_child(parent_of_old_page);
-      void* right_page_rightmost_child = get_page(table->pager, *internal_node_right_child(right_part_page));
-      *node_parent(right_page_rightmost_child) = right_part_id;
-
-      // 其余的子页面指针M 让其指向父页面
-      for (int32_t i = 0; i < right_part_size; ++i) {
-        // printf("Right child has key %s\n", internal_node_key(right_part_page, i));
-        void* right_page_child = get_page(table->pager, *internal_node_child(right_part_page, i));
-        *node_parent(right_page_child) = right_part_id;
-      }
-      
-      // 更新左侧部分的信息
-      *internal_node_num_keys(parent_of_old_page) = left_part_size;
-      for (int32_t i = 0; i < left_part_size; ++i) {
-        // printf("Left child has key %s\n", internal_node_key(parent_of_old_page, i));
-        void* left_page_child = get_page(table->pager, *internal_node_child(parent_of_old_page, i));
-        *node_parent(left_page_child) = parent_of_old_id;
-      }
-      *internal_node_right_child(parent_of_old_page) = reserved_child_for_leftpart; // !!!左侧孩子的最右指针就是被提上去的key对应的指针!
 
-      // print_internal_node_info(parent_of_old_page, parent_of_old_id);
-      // print_internal_node_info(right_part_page, right_part_id);
+/* B-Tree operations */
 
-      return insert_into_parent(table, parent_of_old_id, right_part_id, key_to_liftup_by_old_parent);
+/* the key to select is stored in `statement.row.b` */
+void b_tree_search() {
+  /* print selected rows */
+  char* key_to_find = statement.row.b;
+  Cursor cursor;
+  table_find(table, key_to_find, &cursor);
+  cursor_skip_leaf_end(&cursor);
+  uint32_t counter = 0;
+
+  // each key has a single cell, all of its rows hang off it
+  if (!(cursor.end_of_table)) {
+    void* node = get_page(table->pager, cursor.page_num);
+    if (leaf_node_key_equals(node, cursor.cell_num, key_to_find)) {
+      counter = posting_print_rows(table->pager, node, cursor.cell_num);
     }
+    unpin_page(table->pager, cursor.page_num);
   }
-}
 
-// 叶子 -> 最底层内部节点的插入 : parent: child(叶子)的父结点, child: 是右侧的孩子页面ID
-void internal_node_insert (Table* table, uint32_t parent_page_id, uint32_t child_page_id, char* key_to_insert) {
-  void* parent = get_page(table->pager, parent_page_id);
-  void* child = get_page(table->pager, child_page_id);
-  // char* child_max_key = get_node_max_key(child);
-  char* parent_max_key = get_node_max_key(parent);
-  uint32_t index = internal_node_find_child(parent, key_to_insert);
-
-  uint32_t rightmost_child_page_id = *internal_node_right_child(parent);
-  void* rightmost_child = get_page(table->pager, rightmost_child_page_id); 
-
-  uint32_t original_num_keys = *internal_node_num_keys(parent);
-  *internal_node_num_keys(parent) = original_num_keys + 1; // 增加内部节点的指针数量
-  // print_internal_node_info(parent, parent_page_id);
-
-  // 先假装没有溢出发生! 正常的插入信息, 并且更新相应的指针(如果必要)
-  if (strcmp(key_to_insert, parent_max_key) >= 0) {
-    // 叶子分裂发生在最右侧 -> 原先内部节点的最右孩子指针将指向新的生成页面(child_page_id)
-    // 并将原先的最右指针移到内部的最后一个child内
-    *internal_node_child(parent, original_num_keys) = rightmost_child_page_id;
-    memcpy(internal_node_key(parent, original_num_keys), key_to_insert, INTERNAL_NODE_KEY_SIZE);
-    *internal_node_right_child(parent) = child_page_id;
+  if (counter == 0) {
+    printf("(Empty)\n");
   }
-  else {
-    // | P1 | K1 | ... | P_N | K_N<INDEX> | ... | ... | P_LAST | RIGHTMOST
-    // 
-    for (int32_t i = original_num_keys; i > index; --i) {
-      void* dest = internal_node_cell(parent, i);
-      void* src = internal_node_cell(parent, i - 1);
-      memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
+  return;
+}
+
+/* the range `statement.row.b` to `statement.hi` (both included), or the keys starting with the
+ * prefix in `statement.row.b`. the cursor is placed on the first key once and walks the leaf
+ * chain from there until a key is past the end */
+void b_tree_search_range() {
+  char* first_key = statement.row.b;
+  bool prefix = statement.flag & 8;
+  uint32_t prefix_length = key_length(first_key);
+  Cursor cursor;
+  table_find(table, first_key, &cursor);
+  cursor_skip_leaf_end(&cursor);
+
+  uint32_t counter = 0;
+  while (!(cursor.end_of_table)) {
+    void* node = get_page(table->pager, cursor.page_num);
+    char key[12];
+    leaf_node_get_key(node, cursor.cell_num, key);
+    bool in_range = prefix ? memcmp(key, first_key, prefix_length) == 0 : key_compare(key, statement.hi) <= 0;
+    if (in_range) {
+      counter += posting_print_rows(table->pager, node, cursor.cell_num);
+    }
+    unpin_page(table->pager, cursor.page_num);
+    if (!in_range) {
+      break;
     }
-    *internal_node_child(parent, index + 1) = child_page_id;
-    strncpy(internal_node_key(parent, index), key_to_insert, INTERNAL_NODE_KEY_SIZE);
+    cursor_advance(&cursor);
   }
-  // print_internal_node_info(parent, parent_page_id);
-
-  // 插入一个之后超过了上限, 那么就需要分裂
-  if (original_num_keys + 1 > INTERNAL_NODE_MAX_CELLS) { // a certain number
-    // Fetching a new page from disk 
-    uint32_t new_internal_page_id = get_unused_page_num(table->pager);
-    void* new_internal_node = get_page(table->pager, new_internal_page_id);
 
-    // split origin data into two pages
-    // printf("Left child page id is %d, Right page id is %d\n", parent_page_id, new_internal_page_id);
-    int32_t mid_index = (1 + original_num_keys) / 2;
+  if (counter == 0) {
+    printf("(Empty)\n");
+  }
+}
 
-    // update 右孩子节点的指针信息 与 指针数量
-    int32_t left_child_num_keys = mid_index;
-    // printf("Mid Index is %d\n", mid_index);
+/* 初次分裂才会调用这个函数, 生成一个新的根节点!!!
+*/
+void create_new_root(Table* table, uint32_t left_child_page_num, uint32_t right_child_page_num, char* key) {
+  /* the old root keeps its page, a fresh page on top of it becomes the root,
+     only the root pointer in the header has to change */
+  uint32_t root_page_num = get_unused_page_num(table->pager);
+  void* root = get_page(table->pager, root_page_num);
+  mark_page_dirty(table->pager, root_page_num);
 
-    int32_t right_child_num_keys = original_num_keys - left_child_num_keys;
-    *internal_node_num_keys(new_internal_node) = right_child_num_keys;
+  initialize_internal_node(root);
+  set_node_root(root, true);
+  // actually is 1 key + (rightmost child) 1 = 2 children
+  uint32_t children[2] = {left_child_page_num, right_child_page_num};
+  char keys[1][12];
+  memcpy(keys[0], key, INTERNAL_NODE_KEY_SIZE);
+  internal_node_pack(root, children, keys, 1);
+  unpin_page(table->pager, root_page_num);
 
-    for (int32_t i = 0; i < right_child_num_keys; ++i) {
-      memcpy(internal_node_cell(new_internal_node, i), internal_node_cell(parent, i + left_child_num_keys + 1), INTERNAL_NODE_CELL_SIZE);
-    }
-    
-    *internal_node_right_child(new_internal_node) = *internal_node_right_child(parent);
-    void* right_page_rightmost_child = get_page(table->pager, *internal_node_right_child(new_internal_node));
-    *node_parent(right_page_rightmost_child) = new_internal_page_id;
+  void* left_child = get_page(table->pager, left_child_page_num);
+  mark_page_dirty(table->pager, left_child_page_num);
+  set_node_root(left_child, false);
+  unpin_page(table->pager, left_child_page_num);
 
-    for (int32_t i = 0; i < right_child_num_keys; ++i) {
-      // printf("Right child has key %s\n", internal_node_key(new_internal_node, i));
-      void* right_page_child = get_page(table->pager, *internal_node_child(new_internal_node, i));
-      *node_parent(right_page_child) = new_internal_page_id;
-    }
+  table->root_page_num = root_page_num;
+}
 
-    // update old node's rightmost child_id
-    // print_internal_node_info(parent, parent_page_id);
-    uint32_t left_s_rightmost = *internal_node_child(parent, mid_index);
+void insert_into_parent(Cursor* cursor, uint32_t level, uint32_t left_child_page_num, uint32_t right_child_page_num, char* key);
 
-    *internal_node_right_child(parent) = *internal_node_child(parent, mid_index);
+/* 把 num_keys 个分隔键和它们的孩子写回 cursor 路径上第 level 层的内部节点
+ * 放不下就分裂: 前 left_keys 个键留下, 第 left_keys 个键提升, 其余的键移到新页面,
+ * 两边的字节数尽量相同. 在整棵树的最右侧追加时, 左边尽量装满, 只把最后一个键移走 */
+void internal_node_store (Cursor* cursor, uint32_t level, uint32_t* children, char (*keys)[12], uint32_t num_keys, bool appending) {
+  Table* table = cursor->table;
+  uint32_t page_num = cursor->path[level];
+  void* node = get_page(table->pager, page_num);
+  mark_page_dirty(table->pager, page_num);
+  if (internal_node_packed_bytes(keys, num_keys) <= INTERNAL_NODE_SPACE_FOR_CELLS) {
+    internal_node_pack(node, children, keys, num_keys);
+    unpin_page(table->pager, page_num);
+    return;
+  }
 
-    void* left_page_rightmost_child = get_page(table->pager, *internal_node_right_child(parent));
-    *node_parent(left_page_rightmost_child) = parent_page_id;
+  stats.internal_splits += 1;
+  uint32_t left_keys = appending ? num_keys - 2 : internal_node_even_split(keys, num_keys);
+  uint32_t new_page_num = get_unused_page_num(table->pager);
+  void* new_node = get_page(table->pager, new_page_num);
+  mark_page_dirty(table->pager, new_page_num);
+  initialize_internal_node(new_node);
+  internal_node_pack(new_node, children + left_keys + 1, keys + left_keys + 1, num_keys - left_keys - 1);
+  internal_node_pack(node, children, keys, left_keys);
+
+  unpin_page(table->pager, new_page_num);
+  unpin_page(table->pager, page_num);
+  insert_into_parent(cursor, level, page_num, new_page_num, keys[left_keys]);
+}
 
-    char* key_to_liftup = internal_node_key(parent, mid_index);
-    
-    *internal_node_num_keys(parent) = left_child_num_keys;
-    for (int32_t i = 0; i < left_child_num_keys; ++i) {
-      // printf("Left child has key %s\n", internal_node_key(parent, i));
-      void* left_page_child = get_page(table->pager, *internal_node_child(parent, i));
-      *node_parent(left_page_child) = parent_page_id;
-    }
+// 上层内部节点的插入 & 分裂: right_child 是从 left_child 分裂出来的右半部分, key 是两者之间的分隔键
+// level 是 left_child 在 cursor 路径上的深度, 它的父结点是 path[level - 1]
+void insert_into_parent(Cursor* cursor, uint32_t level, uint32_t left_child_page_num, uint32_t right_child_page_num, char* key) {
+  Table* table = cursor->table;
 
-    return insert_into_parent(table, parent_page_id, new_internal_page_id, key_to_liftup);
-  }
-  else {
-    for (int32_t i = 0; i < *internal_node_num_keys(parent); ++i) {
-      void* child_page = get_page(table->pager, *internal_node_child(parent, i));
-      *node_parent(child_page) = parent_page_id;
-    }
-    void* rightmost_child_page = get_page(table->pager, *internal_node_right_child(parent));
-    *node_parent(rightmost_child_page) = parent_page_id;
+  // 1. 分裂过的节点是原先的根节点, 在它上面新建一个根
+  if (level == 0) {
+    create_new_root(table, left_child_page_num, right_child_page_num, key);
+    return;
   }
+
+  uint32_t parent_page_num = cursor->path[level - 1];
+  uint32_t index = cursor->path_index[level - 1]; // left_child 在父结点中的位置
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+  char keys[INTERNAL_NODE_MAX_KEYS + 1][12];
+  void* parent = get_page(table->pager, parent_page_num);
+  uint32_t num_keys = internal_node_unpack(parent, children, keys);
+  unpin_page(table->pager, parent_page_num);
+
+  // 2. key 放在 index 处, right_child 成为第 index + 1 个孩子, 放不下时父结点分裂
+  //    | P_0 | K_0 | ... | left | key | right | K_index | ... | rightmost
+  memmove(keys[index + 1], keys[index], (num_keys - index) * INTERNAL_NODE_KEY_SIZE);
+  memmove(&children[index + 2], &children[index + 1], (num_keys - index) * INTERNAL_NODE_CHILD_SIZE);
+  memcpy(keys[index], key, INTERNAL_NODE_KEY_SIZE);
+  children[index] = left_child_page_num;
+  children[index + 1] = right_child_page_num;
+  internal_node_store(cursor, level - 1, children, keys, num_keys + 1, index == num_keys && cursor->appending);
 }
 
-/* split full leafnodes into equal halves */
-void leaf_node_split_and_insert (Cursor* cursor, char* key, Row* value) {
+/* split a leaf whose cells do not fit anymore, the bytes are shared out evenly.
+ * a split for appending to the rightmost leaf leaves the left leaf full instead,
+ * so that increasing keys fill the tree densely */
+void leaf_node_split (Cursor* cursor) {
+  cursor->table->append_hint_valid = false;
+  stats.leaf_splits += 1;
   /**
    * Creating a new node
    * Calling table->pager' to fetch a unused page.
    */
   uint32_t old_page_num = cursor->page_num;
-  void* old_node = get_page(cursor->table->pager, old_page_num);
-  char* old_max = get_node_max_key(old_node);
   uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  // printf("Calling LeafNode Split! New Page Id will be %d\n", new_page_num);
+  void* old_node = get_page(cursor->table->pager, old_page_num);
+  mark_page_dirty(cursor->table->pager, old_page_num);
   void* new_node = get_page(cursor->table->pager, new_page_num);
+  mark_page_dirty(cursor->table->pager, new_page_num);
   initialize_leaf_node(new_node);
-  *node_parent(new_node) = *node_parent(old_node);
   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node); // update ptrs to next leaf
   *leaf_node_next_leaf(old_node) = new_page_num;
 
-  /**
-   * Splitting the old leaf, move data to its desired place.
-   */
-  for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; --i) {
-    void* destination_node;
-    uint32_t index_within_node = i;
+  // a full leaf has at least two cells, both halves get some
+  uint32_t num_cells = *leaf_node_num_cells(old_node);
+  cursor->appending = *leaf_node_next_leaf(new_node) == 0 && cursor->cell_num == num_cells;
+  uint32_t left_cells = cursor->appending ? num_cells - 1 : leaf_node_even_split(old_node, new_node);
+  leaf_node_repack(old_node, new_node, left_cells);
+
+  // 分隔键插入父结点: 左边的最大键和右边的最小键之间最短的键
+  char left_max[LEAF_NODE_KEY_SIZE];
+  char right_min[LEAF_NODE_KEY_SIZE];
+  char key_to_liftup[LEAF_NODE_KEY_SIZE];
+  leaf_node_get_key(old_node, left_cells - 1, left_max);
+  leaf_node_get_key(new_node, 0, right_min);
+  key_separator(left_max, right_min, key_to_liftup);
+  unpin_page(cursor->table->pager, new_page_num);
+  unpin_page(cursor->table->pager, old_page_num);
+
+  insert_into_parent(cursor, cursor->depth, old_page_num, new_page_num, key_to_liftup);
+}
 
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-      destination_node = new_node;
-      index_within_node = i - LEAF_NODE_LEFT_SPLIT_COUNT;
-    } else {
-      destination_node = old_node;
+/* insert value under key into the leaf the cursor points at: a new cell for a new key,
+ * otherwise one more value in front of the key's posting list.
+ * returns false if the leaf has no room even after compacting it, it must be split then */
+bool leaf_node_insert (Cursor* cursor, char* key, uint32_t value) {
+  Pager* pager = cursor->table->pager;
+  void* node = get_page(pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t cell_num = cursor->cell_num;
+  bool found = cell_num < num_cells && leaf_node_key_equals(node, cell_num, key);
+  if (!found) {
+    // a new key shortens the prefix of the leaf if it does not start with it
+    mark_page_dirty(pager, cursor->page_num);
+    if (!leaf_node_take_prefix(node, key, 1)) {
+      unpin_page(pager, cursor->page_num);
+      return false;
     }
-    
-    void* destination = leaf_node_cell(destination_node, index_within_node); // cell = <key, value>
+  }
 
-    if (i == cursor->cell_num) {
-      serialize_row(value, leaf_node_cell(destination_node, index_within_node));
-      memcpy(leaf_node_key(destination_node, index_within_node), key, 12);
-    } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE); // copy value
-    } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+  uint32_t prefix_length = *leaf_node_prefix_length(node);
+  uint32_t cell_size = LEAF_NODE_KEY_SIZE - prefix_length + LEAF_NODE_POSTING_COUNT_SIZE; // without the posting list
+  uint32_t needed = found ? cell_size + (*leaf_node_posting_count(node, cell_num) + 1) * LEAF_NODE_VALUE_SIZE
+                          : leaf_cell_size(LEAF_NODE_KEY_SIZE - prefix_length, 1);
+  if (found && *leaf_node_posting_count(node, cell_num) >= LEAF_NODE_MAX_POSTING) {
+    needed = 0; // goes to overflow pages
+  }
+  else if (found && *leaf_node_slot(node, cell_num) == *leaf_node_heap_start(node)) {
+    needed = LEAF_NODE_VALUE_SIZE; // the cell is at the front of the heap and grows in place
+  }
+  if (leaf_node_free_space(node) < needed) {
+    if (LEAF_NODE_SPACE_FOR_CELLS - leaf_node_used_bytes(node) < needed) {
+      unpin_page(pager, cursor->page_num);
+      return false;
     }
+    mark_page_dirty(pager, cursor->page_num);
+    leaf_node_repack(node, NULL, num_cells);
+    unpin_page(pager, cursor->page_num);
+    return leaf_node_insert(cursor, key, value);
+  }
+  mark_page_dirty(pager, cursor->page_num);
+
+  if (!found) {
+    // Make room for new slot, the cell goes to the front of the heap
+    memmove(leaf_node_slot(node, cell_num + 1), leaf_node_slot(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+    *leaf_node_slot(node, cell_num) = leaf_node_heap_alloc(node, cell_size + LEAF_NODE_VALUE_SIZE);
+    memcpy(leaf_node_key_suffix(node, cell_num), key + prefix_length, LEAF_NODE_KEY_SIZE - prefix_length);
+    *leaf_node_posting_count(node, cell_num) = 1;
+    *leaf_node_posting(node, cell_num) = value;
+    *leaf_node_num_cells(node) = num_cells + 1;
+  }
+  else if (*leaf_node_posting_count(node, cell_num) == POSTING_OVERFLOW) {
+    uint32_t* head = leaf_node_posting(node, cell_num);
+    *head = overflow_append(pager, *head, value);
+  }
+  else if (*leaf_node_posting_count(node, cell_num) >= LEAF_NODE_MAX_POSTING) {
+    // the list is full, it moves to an overflow page and the leaf keeps the page number
+    uint32_t head = posting_spill(pager, node, cell_num);
+    *leaf_node_posting(node, cell_num) = overflow_append(pager, head, value);
+    *leaf_node_posting_count(node, cell_num) = POSTING_OVERFLOW;
+  }
+  else {
+    uint16_t count = *leaf_node_posting_count(node, cell_num);
+    void* old_cell = leaf_node_cell(node, cell_num);
+    if (*leaf_node_slot(node, cell_num) == *leaf_node_heap_start(node)) {
+      // key and count move down by one value, the new value takes their place
+      *leaf_node_slot(node, cell_num) = leaf_node_heap_alloc(node, LEAF_NODE_VALUE_SIZE);
+      memmove(leaf_node_cell(node, cell_num), old_cell, cell_size);
+    }
+    else {
+      // the old cell is left behind as a hole, it goes away when the leaf is repacked
+      *leaf_node_slot(node, cell_num) = leaf_node_heap_alloc(node, cell_size + (count + 1) * LEAF_NODE_VALUE_SIZE);
+      memcpy(leaf_node_cell(node, cell_num), old_cell, cell_size);
+      memcpy(leaf_node_posting(node, cell_num) + 1, old_cell + cell_size, count * LEAF_NODE_VALUE_SIZE);
+    }
+    *leaf_node_posting(node, cell_num) = value;
+    *leaf_node_posting_count(node, cell_num) = count + 1;
+  }
+  unpin_page(pager, cursor->page_num);
+  return true;
+}
 
-    /* Update cell count on both leaf nodes */
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-
+/* insert value under key into the tree of table */
+void table_insert (Table* table, char* key_to_insert, uint32_t value) {
+  // a full leaf is split and the insert tried again,
+  // keys behind the largest one go straight to the rightmost leaf
+  bool inserted = false;
+  while (!inserted) {
+    Cursor cursor;
+    if (!table_find_append(table, key_to_insert, &cursor)) {
+      table_find(table, key_to_insert, &cursor);
+    }
+    inserted = leaf_node_insert(&cursor, key_to_insert, value);
+    if (!inserted) {
+      leaf_node_split(&cursor);
+    }
   }
+}
 
-  if (is_node_root(old_node)) {
-    return create_new_root(cursor->table, new_page_num);
-  } else {
-    uint32_t parent_page_num = *node_parent(old_node); // 拿到父结点的页面号
-    char* new_max = get_node_max_key(old_node); // old_node 是左边节点的最大键
-    void* parent = get_page(cursor->table->pager, parent_page_num); 
+/* needed declarations */
+void index_a_insert (uint32_t a, char* b);
+void index_a_delete_rows (Cursor* cursor, char* b);
 
-    // Magic Here?
-    // update_internal_node_key(parent, old_max, new_max); // 分裂之后把左边的键加入到父结点中,更新
-    internal_node_insert(cursor->table, parent_page_num, new_page_num, new_max);
-    return;
+/* the row to insert is stored in `statement.row` */
+void b_tree_insert() {
+  /* insert a row */
+
+  // get the row first
+  Row* row_to_insert = &(statement.row);
+
+  // the table is keyed by b, the index (if any) by a
+  table_insert(table, row_to_insert->b, row_to_insert->a);
+  if (index_a) {
+    index_a_insert(row_to_insert->a, row_to_insert->b);
   }
+  table->num_rows += 1;
 }
 
-/* insert value into B+ Tree's leafnode */
-void leaf_node_insert (Cursor* cursor, char* key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+/* ------------------------------------------- */
 
-  // split leaf nodes and do insertion
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    return leaf_node_split_and_insert(cursor, key, value);
-  }
+/* drop separator `index` together with the child on its right,
+   after that child has been merged into child `index` */
+void internal_node_remove (void* node, uint32_t index) {
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 1];
+  char keys[INTERNAL_NODE_MAX_KEYS][12];
+  uint32_t num_keys = internal_node_unpack(node, children, keys);
+  memmove(keys[index], keys[index + 1], (num_keys - index - 1) * INTERNAL_NODE_KEY_SIZE);
+  memmove(&children[index + 1], &children[index + 2], (num_keys - index - 1) * INTERNAL_NODE_CHILD_SIZE);
+  internal_node_pack(node, children, keys, num_keys - 1);
+}
 
-  if (cursor->cell_num < num_cells) {
-    // Make room for new cell
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-    }
-  }
+/* replace separator `index` of the internal node at level of the cursor path,
+   a longer separator may not fit anymore and split the node */
+void internal_node_replace_key (Cursor* cursor, uint32_t level, uint32_t index, char* key) {
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 1];
+  char keys[INTERNAL_NODE_MAX_KEYS][12];
+  void* node = get_page(cursor->table->pager, cursor->path[level]);
+  uint32_t num_keys = internal_node_unpack(node, children, keys);
+  unpin_page(cursor->table->pager, cursor->path[level]);
+  memcpy(keys[index], key, INTERNAL_NODE_KEY_SIZE);
+  internal_node_store(cursor, level, children, keys, num_keys, false);
+}
 
-  *(leaf_node_num_cells(node)) += 1;
+/* 调整根节点的函数: a root without keys hands the root pointer over to its only child */
+bool adjust_root (Table* table, void* node, uint32_t node_id) {
+  if (get_node_type(node) == NODE_LEAF || *internal_node_num_keys(node) > 0) {
+    // a leaf root may even be empty, the tree just has no rows then
+    return false;
+  }
 
-  /* memcpy key to target postion (instead of using pointers) */
-  char* pos = (leaf_node_key(node, cursor->cell_num));
-  memcpy(pos, value->b, 12);
+  // the tree shrinks by one level
+  table->append_hint_valid = false;
+  uint32_t child_id = *internal_node_right_child(node);
+  void* child = get_page(table->pager, child_id);
+  mark_page_dirty(table->pager, child_id);
+  set_node_root(child, true);
+  unpin_page(table->pager, child_id);
+
+  table->root_page_num = child_id;
+  free_page(table->pager, node_id);
+  return true;
+}
 
-  serialize_row(value, leaf_node_cell(node, cursor->cell_num));
+// separators and children of left, the separator between them and right in a row, returns the number of separators
+uint32_t internal_node_join (void* left, void* right, char* separator, uint32_t* children, char (*keys)[12]) {
+  uint32_t left_keys = internal_node_unpack(left, children, keys);
+  memcpy(keys[left_keys], separator, INTERNAL_NODE_KEY_SIZE);
+  return left_keys + 1 + internal_node_unpack(right, children + left_keys + 1, keys + left_keys + 1);
 }
 
-/* the row to insert is stored in `statement.row` */
-void b_tree_insert() {
-  /* insert a row */
+/* 内部节点重新分配算法: left, separator and right are lined up and cut again where both
+ * nodes get about the same bytes, the key at the cut is the new separator */
+void internalnode_redistribute (void* left, void* right, char* separator) {
+  uint32_t children[2 * INTERNAL_NODE_MAX_KEYS + 2];
+  char keys[2 * INTERNAL_NODE_MAX_KEYS + 1][12];
+  uint32_t num_keys = internal_node_join(left, right, separator, children, keys);
+  uint32_t left_keys = internal_node_even_split(keys, num_keys);
+  internal_node_pack(left, children, keys, left_keys);
+  internal_node_pack(right, children + left_keys + 1, keys + left_keys + 1, num_keys - left_keys - 1);
+  memcpy(separator, keys[left_keys], INTERNAL_NODE_KEY_SIZE);
+}
 
-  // get the row first
-  Row* row_to_insert = &(statement.row);
+/* 叶子节点的重新分配算法函数: even out the bytes of two adjacent leaves, separator is set to
+ * the shortest key between them */
+void leaf_redistribute (void* left, void* right, char* separator) {
+  uint32_t left_cells = leaf_node_even_split(left, right);
+  leaf_node_repack(left, right, left_cells);
+
+  char left_max[LEAF_NODE_KEY_SIZE];
+  char right_min[LEAF_NODE_KEY_SIZE];
+  leaf_node_get_key(left, left_cells - 1, left_max);
+  leaf_node_get_key(right, 0, right_min);
+  key_separator(left_max, right_min, separator);
+}
 
-  // find the right pos to insert
-  char* key_to_insert = row_to_insert->b;
+// bytes left, separator and right would use in one internal node
+uint32_t internal_node_merged_bytes (void* left, void* right, char* separator) {
+  uint32_t children[2 * INTERNAL_NODE_MAX_KEYS + 2];
+  char keys[2 * INTERNAL_NODE_MAX_KEYS + 1][12];
+  uint32_t num_keys = internal_node_join(left, right, separator, children, keys);
+  return internal_node_packed_bytes(keys, num_keys);
+}
 
-  Cursor* cursor = table_find(table, key_to_insert);
-  
-  leaf_node_insert(cursor, row_to_insert->b, row_to_insert);
+/* 内部节点合并算法: pull the separator down and append everything of right to left */
+void internalnode_merge (void* left, void* right, char* separator) {
+  uint32_t children[2 * INTERNAL_NODE_MAX_KEYS + 2];
+  char keys[2 * INTERNAL_NODE_MAX_KEYS + 1][12];
+  uint32_t num_keys = internal_node_join(left, right, separator, children, keys);
+  internal_node_pack(left, children, keys, num_keys);
+}
 
-  free(cursor);
+/* 合并两个叶子节点的算法: right is appended to left */
+void leafnode_merge (void* left, void* right) {
+  leaf_node_repack(left, right, *leaf_node_num_cells(left) + *leaf_node_num_cells(right));
+  *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+  *leaf_node_next_leaf(right) = 0;
 }
 
-/* ------------------------------------------- */
+/* 判断节点下溢的情况选择合并 还是 重新分配的函数, returns true if node was merged
+ * level: 节点在 cursor 路径上的深度, cursor->depth 是叶子节点本身 */
+bool merge_or_redistribute (Cursor* cursor, uint32_t level) {
+  uint32_t node_id = (level == cursor->depth) ? cursor->page_num : cursor->path[level];
+  void* node = get_page(cursor->table->pager, node_id);
 
-bool merge_or_redistribute (void* node, uint32_t node_id, char* key);
+  if (level == 0) {
+    bool adjusted = adjust_root(cursor->table, node, node_id);
+    unpin_page(cursor->table->pager, node_id);
+    return adjusted;
+  } 
+  
+  // 根据节点类型进行相应的判断
+  // 如果删除后节点数不发生下溢, 则直接返回
+  NodeType node_type = get_node_type(node);
+  bool underflow = (node_type == NODE_LEAF)
+    ? leaf_node_used_bytes(node) < LEAF_NODE_MIN_BYTES
+    : internal_node_used_bytes(node) < INTERNAL_NODE_MIN_BYTES;
+  unpin_page(cursor->table->pager, node_id);
+  if (!underflow) {
+    return false;
+  }
 
-/* 调整根节点的函数 */
-bool adjust_root (void* node, uint32_t node_id) {
-  NodeType root_type = get_node_type(node);
-  if (root_type == NODE_INTERNAL) {
-    uint32_t num_cells_in_root = *internal_node_num_keys(node);
-    if (num_cells_in_root >= 1) {
-      return false;
+  // 否则, 需要进行合并 / 重新分配: pair node with its right sibling,
+  // the path to the rightmost leaf may change
+  // or with its left sibling if node is the rightmost child
+  cursor->table->append_hint_valid = false;
+  uint32_t parent_id = cursor->path[level - 1];
+  void* parent_node = get_page(cursor->table->pager, parent_id);
+  uint32_t child_index = cursor->path_index[level - 1];
+  uint32_t left_index = child_index < *internal_node_num_keys(parent_node) ? child_index : child_index - 1;
+
+  uint32_t left_id = *internal_node_child(parent_node, left_index);
+  uint32_t right_id = *internal_node_child(parent_node, left_index + 1);
+  char separator[INTERNAL_NODE_KEY_SIZE];
+  internal_node_get_key(parent_node, left_index, separator);
+  void* left = get_page(cursor->table->pager, left_id);
+  mark_page_dirty(cursor->table->pager, left_id);
+  void* right = get_page(cursor->table->pager, right_id);
+  mark_page_dirty(cursor->table->pager, right_id);
+
+  bool merged;
+  if (node_type == NODE_LEAF) {
+    merged = leaf_node_merged_bytes(left, right) <= LEAF_NODE_SPACE_FOR_CELLS;
+    if (merged) {
+      leafnode_merge(left, right);
     }
     else {
-      // 根节点空了!
-      printf("Invalid Operation!\n");
-      exit(EXIT_FAILURE);
+      leaf_redistribute(left, right, separator);
     }
   }
   else {
-    // 根是叶子节点, 说明整棵树只有一个节点了!
-    uint32_t num_cells_in_root = *leaf_node_num_cells(node);
-    if (num_cells_in_root >= 1) {
-      // printf("Delete key from RootNode!\n");
-      return false; // ok
-    }
-    else {
-      // the whole tree is empty
-      // printf("The Whole Tree is now Empty!\n");
-      return true;
+    merged = internal_node_merged_bytes(left, right, separator) <= INTERNAL_NODE_SPACE_FOR_CELLS;
+    if (merged) {
+      internalnode_merge(left, right, separator);
+    }
+    else {
+      internalnode_redistribute(left, right, separator);
+    }
+  }
+
+  unpin_page(cursor->table->pager, left_id);
+  unpin_page(cursor->table->pager, right_id);
+  if (merged) {
+    stats.merges += 1;
+    // right is empty now and nobody points at it anymore, the parent lost a key
+    mark_page_dirty(cursor->table->pager, parent_id);
+    internal_node_remove(parent_node, left_index);
+    unpin_page(cursor->table->pager, parent_id);
+    free_page(cursor->table->pager, right_id);
+    merge_or_redistribute(cursor, level - 1);
+  }
+  else {
+    stats.redistributions += 1;
+    // the new separator may be longer than the old one
+    unpin_page(cursor->table->pager, parent_id);
+    internal_node_replace_key(cursor, level - 1, left_index, separator);
+  }
+  return merged;
+}
+
+/* 实现 叶子节点内部的关键值删除, cursor 指向待删除的位置
+ * the key's cell goes away together with its posting list and the leaf is rebalanced,
+ * returns the number of removed rows */
+uint32_t leaf_node_delete (Cursor* cursor, char* keys_to_delete) {
+  // 当前执行删除的叶子节点
+  uint32_t page_id = cursor->page_num;
+  uint32_t cell_num = cursor->cell_num;
+  void* node = get_page(cursor->table->pager, page_id);
+  // 当前叶子节点拥有的键数
+  uint32_t leaf_num_cells = *leaf_node_num_cells(node);
+
+  // 判断!找到的位置与待删除的键进行比较, 如果不一样, 说明不存在该键, 直接返回
+  if (cell_num >= leaf_num_cells || !leaf_node_key_equals(node, cell_num, keys_to_delete)) {
+    unpin_page(cursor->table->pager, page_id);
+    return 0;
+  }
+  mark_page_dirty(cursor->table->pager, page_id);
+
+  uint32_t removed = posting_free(cursor->table->pager, node, cell_num);
+  // only the slot goes away, the cell is left behind as a hole in the heap
+  memmove(leaf_node_slot(node, cell_num), leaf_node_slot(node, cell_num + 1),
+          (leaf_num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+  *leaf_node_num_cells(node) = leaf_num_cells - 1;
+  unpin_page(cursor->table->pager, page_id);
+
+  merge_or_redistribute(cursor, cursor->depth);
+  return removed;
+}
+
+/* the key to delete is stored in `statement.row.b` */
+void b_tree_delete() {
+  /* delete row(s) */  
+  char* keys_to_delete = statement.row.b;
+
+  Cursor cursor;
+  table_find(table, keys_to_delete, &cursor);
+  cursor_skip_leaf_end(&cursor);
+  if (!cursor.end_of_table) {
+    if (index_a) {
+      index_a_delete_rows(&cursor, keys_to_delete);
+    }
+    table->num_rows -= leaf_node_delete(&cursor, keys_to_delete);
+  }
+}
+
+void b_tree_traverse() {
+  /* print all rows */
+  Cursor cursor;
+  table_start(table, &cursor);
+  if (cursor.end_of_table) {
+    printf("(Empty)\n");
+  }
+  else {
+    while (!(cursor.end_of_table)) {
+      void* node = get_page(table->pager, cursor.page_num);
+      posting_print_rows(table->pager, node, cursor.cell_num);
+      unpin_page(table->pager, cursor.page_num);
+      cursor_advance(&cursor);
     }
   }
-  
+  return;
 }
 
-/* 内部节点重新分配算法 */
-void internalnode_redistribute (void* cur_node, void* sib_node, void* parent_node, uint32_t value_index, bool rightmost) {
-  // printf("Called Internal Node Redistribute!\n");
+/*---------- Index on a --------------*/
 
-  // 父节点借出的节点键值
-  char key_from_parent[12];
-  strncpy(key_from_parent, internal_node_key(parent_node, value_index), INTERNAL_NODE_KEY_SIZE);
+/* An optional second tree that finds the rows by column a, created by `.index a` and kept up to
+ * date by inserts, deletes and loads from then on. its key is a, big-endian so that keys sort by
+ * it, followed by the first INDEX_A_KEY_B_SIZE bytes of b. the rest of b does not fit into the
+ * key and is packed into the values of the posting list instead */
 
-  // 兄弟节点借出的节点键值
-  char key_from_sib[12];
-  uint32_t child_id_from_sib;
-  uint32_t sib_node_size;
-  uint32_t cur_node_size;
+#define INDEX_A_KEY_B_SIZE 8 // b is at most COLUMN_B_SIZE bytes, the last 3 go into the value
 
-  if (rightmost) {
-    sib_node_size = *internal_node_num_keys(sib_node);
-    strncpy(key_from_sib, internal_node_key(sib_node, sib_node_size - 1), INTERNAL_NODE_KEY_SIZE);
-    // 位于左侧, 则借出的是最右指针
-    child_id_from_sib = *internal_node_right_child(sib_node);
+void index_a_key (uint32_t a, const char* b, char* key) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  a = __builtin_bswap32(a);
+#endif
+  memcpy(key, &a, sizeof(a));
+  memcpy(key + sizeof(a), b, INDEX_A_KEY_B_SIZE);
+}
 
-    // 第一步, 修改兄弟内部节点的指针, 删掉最后一个
-    uint32_t new_rightmost_id = *internal_node_child(sib_node, sib_node_size - 1);
-    *internal_node_right_child(sib_node) = new_rightmost_id;
-    *internal_node_num_keys(sib_node) = sib_node_size - 1;
+uint32_t index_a_value (const char* b) {
+  uint32_t value = 0;
+  memcpy(&value, b + INDEX_A_KEY_B_SIZE, COLUMN_B_SIZE - INDEX_A_KEY_B_SIZE);
+  return value;
+}
 
-    // 第二步, 将父结点的键借给右孩子
-    cur_node_size = *internal_node_num_keys(cur_node);
-    *internal_node_num_keys(cur_node) = cur_node_size + 1;
-    memcpy(internal_node_key(cur_node, 0), key_from_parent, INTERNAL_NODE_KEY_SIZE);
+// column a of an index key
+uint32_t index_a_key_a (const char* key) {
+  return key_high(key) >> 32;
+}
 
-    // 第三步, 将父结点对应的键值修改
-    strncpy(internal_node_key(parent_node, value_index), key_from_sib, INTERNAL_NODE_KEY_SIZE);
+// a row of the index, put back together from its key and value
+void print_index_a_row (char* key, uint32_t value, void* arg) {
+  (void)arg;
+  Row row;
+  row.a = index_a_key_a(key);
+  memcpy(row.b, key + sizeof(uint32_t), INDEX_A_KEY_B_SIZE);
+  memcpy(row.b + INDEX_A_KEY_B_SIZE, &value, sizeof(value)); // ends with the terminating zero
+  print_row(&row);
+}
 
-    // 第四步, 修改移入右侧内部节点的最左指针, 为原先兄弟的最右指针
-    *internal_node_child(cur_node, 0) = child_id_from_sib;
+void index_a_insert (uint32_t a, char* b) {
+  char key[12];
+  index_a_key(a, b, key);
+  table_insert(index_a, key, index_a_value(b));
+}
 
+/* drop every value equal to value from the posting list of key, the cell goes away
+ * with the last one */
+void index_a_remove (char* key, uint32_t value) {
+  Pager* pager = index_a->pager;
+  Cursor cursor;
+  table_find(index_a, key, &cursor);
+  cursor_skip_leaf_end(&cursor);
+  if (cursor.end_of_table) {
+    return;
+  }
+  void* node = get_page(pager, cursor.page_num);
+  if (!leaf_node_key_equals(node, cursor.cell_num, key)) {
+    unpin_page(pager, cursor.page_num);
+    return;
+  }
+  mark_page_dirty(pager, cursor.page_num);
+
+  uint32_t left = 0; // values still in the list
+  uint16_t count = *leaf_node_posting_count(node, cursor.cell_num);
+  uint32_t* values = leaf_node_posting(node, cursor.cell_num);
+  if (count != POSTING_OVERFLOW) {
+    // the cell shrinks in place, the bytes behind it are a hole until the leaf is repacked
+    for (uint32_t i = 0; i < count; ++i) {
+      if (values[i] != value) {
+        values[left++] = values[i];
+      }
+    }
+    if (left > 0) {
+      *leaf_node_posting_count(node, cursor.cell_num) = left;
+    }
   }
   else {
-    // 不是最右侧内部节点! child_id_from_sib = 右侧第一个孩子节点
-    strncpy(key_from_sib, internal_node_key(sib_node, 0), INTERNAL_NODE_KEY_SIZE);
-
-    // 位于右侧的兄弟节点 借出节点 对应的孩子指针
-    child_id_from_sib = *internal_node_child(sib_node, 0);
+    // every overflow page is compacted on its own, pages left empty are unlinked and freed
+    uint32_t prev_page_num = 0;
+    uint32_t page_num = *values;
+    while (page_num != 0) {
+      void* overflow = get_page(pager, page_num);
+      mark_page_dirty(pager, page_num);
+      uint32_t num_values = *overflow_node_num_values(overflow);
+      uint32_t kept = 0;
+      for (uint32_t i = 0; i < num_values; ++i) {
+        if (*overflow_node_value(overflow, i) != value) {
+          *overflow_node_value(overflow, kept++) = *overflow_node_value(overflow, i);
+        }
+      }
+      *overflow_node_num_values(overflow) = kept;
+      uint32_t next_page_num = *overflow_node_next(overflow);
+      unpin_page(pager, page_num);
 
-    // 第一步, 修改兄弟内部节点的指针, 删掉第一个
-    sib_node_size = *internal_node_num_keys(sib_node);
-    for (int32_t i = 0; i < sib_node_size - 1; ++i) {
-      void* dst = internal_node_cell(sib_node, i);
-      void* src = internal_node_cell(sib_node, i + 1);
-      memcpy(dst, src, INTERNAL_NODE_CELL_SIZE);
+      if (kept == 0) {
+        if (prev_page_num == 0) {
+          *values = next_page_num;
+        }
+        else {
+          void* prev = get_page(pager, prev_page_num);
+          mark_page_dirty(pager, prev_page_num);
+          *overflow_node_next(prev) = next_page_num;
+          unpin_page(pager, prev_page_num);
+        }
+        free_page(pager, page_num);
+      }
+      else {
+        prev_page_num = page_num;
+      }
+      left += kept;
+      page_num = next_page_num;
     }
-    *internal_node_num_keys(sib_node) = sib_node_size - 1;
-
-    // 第二步, 将父结点的键借给左孩子
-    cur_node_size = *internal_node_num_keys(cur_node) + 1;
-    // printf("Current Internal Node has %d keys\n", cur_node_size);
-
-    *internal_node_num_keys(cur_node) = cur_node_size;
-    strncpy(internal_node_key(cur_node, cur_node_size - 1), key_from_parent, INTERNAL_NODE_KEY_SIZE);
-
-    // 第三步, 将父结点对应的键值修改
-    strncpy(internal_node_key(parent_node, value_index), key_from_sib, INTERNAL_NODE_KEY_SIZE);
+  }
+  unpin_page(pager, cursor.page_num);
 
-    // 第四步, 修改移入左侧内部节点的最右指针, 为原先兄弟的最左指针
-    *internal_node_right_child(cur_node) = child_id_from_sib;
+  if (left == 0) {
+    leaf_node_delete(&cursor, key);
+  }
+  else if (count != POSTING_OVERFLOW && left < count) {
+    merge_or_redistribute(&cursor, cursor.depth);
   }
 }
 
-/* 叶子节点的重新分配算法函数 */
-void leaf_redistribute (void* node, void* sib_node, void* parent_node, uint32_t value_index) {
-  // value_index : the pointer index in parent_node
-  // redistribute: from sib_node to node!
-  // node: 删除操作发生的叶子节点
-  // sib_node: node的兄弟节点(一般为右结点, 除非删除发生在最右), 将其中一个键分配给node
-
-  // printf("Called Leaf Node Redistribute!\n"); // 测试信息
-
-  uint32_t next_id = *leaf_node_next_leaf(node);
-  bool has_right_sib = false;
-  if (next_id != 0) {
-    has_right_sib = true;
+/* values of a posting list, collected by a PostingVisitor */
+typedef struct {
+  uint32_t* values;
+  uint32_t num_values;
+  uint32_t capacity;
+} ValueList;
+
+void collect_value (char* key, uint32_t value, void* arg) {
+  (void)key;
+  ValueList* list = arg;
+  if (list->num_values == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->values = realloc(list->values, list->capacity * sizeof(uint32_t));
   }
+  list->values[list->num_values++] = value;
+}
 
-  if (has_right_sib) {
-    uint32_t cur_node_num_cells = *leaf_node_num_cells(node);
-    char key_to_replace[12]; // temporary buffer
-    memcpy(key_to_replace, leaf_node_key(sib_node, 0), LEAF_NODE_KEY_SIZE);
-    memcpy(leaf_node_cell(node, cur_node_num_cells), leaf_node_cell(sib_node, 0), LEAF_NODE_CELL_SIZE);
-    *leaf_node_num_cells(node) = cur_node_num_cells + 1;
+/* the rows with column b equal to b are about to be deleted from the table,
+ * cursor points at their cell. their entries go from the index first */
+void index_a_delete_rows (Cursor* cursor, char* b) {
+  ValueList list = {0};
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+  if (cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key_equals(node, cursor->cell_num, b)) {
+    posting_for_each(cursor->table->pager, node, cursor->cell_num, collect_value, &list);
+  }
+  unpin_page(cursor->table->pager, cursor->page_num);
+
+  // a repeated a finds nothing left to remove the second time
+  uint32_t value = index_a_value(b);
+  for (uint32_t i = 0; i < list.num_values; ++i) {
+    char key[12];
+    index_a_key(list.values[i], b, key);
+    index_a_remove(key, value);
+  }
+  free(list.values);
+}
 
-    // change cell arrangements in sib node
-    int32_t sib_node_size = *leaf_node_num_cells(sib_node);
-    for (int32_t i = 0; i < sib_node_size - 1; ++i) {
-      memcpy(leaf_node_cell(sib_node, i), leaf_node_cell(sib_node, i + 1), LEAF_NODE_CELL_SIZE);
+// print the rows with column a equal to a through the index, returns how many there were
+uint32_t index_a_search (uint32_t a) {
+  char no_b[12] = {0};
+  char key[12];
+  index_a_key(a, no_b, key); // sorts before all keys starting with a
+  Cursor cursor;
+  table_find(index_a, key, &cursor);
+  cursor_skip_leaf_end(&cursor);
+
+  uint32_t counter = 0;
+  while (!cursor.end_of_table) {
+    void* node = get_page(index_a->pager, cursor.page_num);
+    char cell_key[12];
+    leaf_node_get_key(node, cursor.cell_num, cell_key);
+    bool match = index_a_key_a(cell_key) == a;
+    if (match) {
+      counter += posting_for_each(index_a->pager, node, cursor.cell_num, print_index_a_row, NULL);
+    }
+    unpin_page(index_a->pager, cursor.page_num);
+    if (!match) {
+      break;
     }
-    *leaf_node_num_cells(sib_node) = sib_node_size - 1;
+    cursor_advance(&cursor);
+  }
+  return counter;
+}
 
-    // change key in parent node ?
-    // printf("Key index to be replaced in the internal node is [%d], key [%s]\n", value_index, key_to_replace);
+/* column a to look for in a scan of the table, and how many rows had it */
+typedef struct {
+  uint32_t a;
+  uint32_t printed;
+} ScanA;
+
+void print_table_row_with_a (char* key, uint32_t value, void* arg) {
+  ScanA* scan = arg;
+  if (value == scan->a) {
+    print_table_row(key, value, NULL);
+    scan->printed += 1;
+  }
+}
 
-    memcpy(internal_node_key(parent_node, value_index), key_to_replace, INTERNAL_NODE_KEY_SIZE);
-    return;
+// print the rows with column a equal to a by looking at every row, returns how many there were
+uint32_t table_scan_a (uint32_t a) {
+  ScanA scan = {a, 0};
+  Cursor cursor;
+  table_start(table, &cursor);
+  while (!(cursor.end_of_table)) {
+    void* node = get_page(table->pager, cursor.page_num);
+    posting_for_each(table->pager, node, cursor.cell_num, print_table_row_with_a, &scan);
+    unpin_page(table->pager, cursor.page_num);
+    cursor_advance(&cursor);
   }
-  else {
-    char left_sib_last[12];
-    uint32_t left_sib_size = *leaf_node_num_cells(sib_node);
-    memcpy(left_sib_last, leaf_node_key(sib_node, left_sib_size - 1), LEAF_NODE_KEY_SIZE);
-
-    // make room for first key
-    uint32_t cur_node_size = *leaf_node_num_cells(node);
-    for (int32_t i = cur_node_size; i >= 1; --i) {
-      void* dst = leaf_node_cell(node, i);
-      void* src = leaf_node_cell(node, i - 1);
-      memcpy(dst, src, LEAF_NODE_CELL_SIZE);
-    }
-
-    // copying into cur_node(on the right-side)
-    memcpy(leaf_node_cell(node, 0), leaf_node_cell(sib_node, left_sib_size - 1), LEAF_NODE_CELL_SIZE);
-    
-    // modifying key in parent node
-    memcpy(internal_node_key(parent_node, value_index), left_sib_last, INTERNAL_NODE_KEY_SIZE);
-    return;
+  return scan.printed;
+}
+
+/* the a to select is stored in `statement.row.a`, without an index every row is looked at */
+void b_tree_search_a() {
+  uint32_t counter = index_a ? index_a_search(statement.row.a) : table_scan_a(statement.row.a);
+  if (counter == 0) {
+    printf("(Empty)\n");
   }
 }
 
-/* 内部节点合并算法 */
-void internalnode_merge (void* sib_page, void* cur_page, void* parent_page, uint32_t parent_id, char* key, bool rightmost) {
-  // first borrowing from parent node
-  uint32_t child_index_in_parent = internal_node_find_child(parent_page, key);
-  uint32_t cur_size = *internal_node_num_keys(cur_page); // 当前节点的键数
-  uint32_t sib_size = *internal_node_num_keys(sib_page); // 兄弟节点的键数
-  char key_to_borrow_buf[12];
+/*---------------------------------------------*/
 
-  memcpy(key_to_borrow_buf, internal_node_key(parent_page, child_index_in_parent), INTERNAL_NODE_KEY_SIZE);
-  // printf("Borrowed Key [%s] from parent! Index is [%d]\n", key_to_borrow_buf, child_index_in_parent);
-  // printf("Before borrowing from parent, cur_node size is [%d]\n", cur_size);
-  memcpy(internal_node_key(cur_page, cur_size), key_to_borrow_buf, INTERNAL_NODE_KEY_SIZE);
 
-  // 调整父结点内部的键,指针情况
-  int32_t num_keys_in_parent = *internal_node_num_keys(parent_page);
-  *internal_node_num_keys(parent_page) = num_keys_in_parent - 1;
-  for (int32_t i = child_index_in_parent; i < num_keys_in_parent - 1; ++i) {
-    void* dst = internal_node_cell(parent_page, i);
-    void* src = internal_node_cell(parent_page, i + 1);
-    memcpy(dst, src, INTERNAL_NODE_CELL_SIZE);
-  }
 
-  cur_size += 1;
-  // printf("After borrowing from parent, cur_node size is [%d]\n", cur_size);  
-  *internal_node_num_keys(cur_page) = sib_size + cur_size;
-  // printf("%d\n", *internal_node_num_keys(cur_page));
+/*---------- Bulk Load --------------*/
 
-  // 当前内部节点与兄弟节点进行合并
-  if (rightmost) {
-    // 右边 合并 左边
-    // 右边的内部节点给左边的腾出空间
-    // cur_size 向后移动 sib_size
+/* `.load <file>` reads rows given as `insert <a> <b>` (or just `<a> <b>`) lines.
+ * the rows are sorted by key in runs of LOAD_RUN_ROWS, larger inputs spill the runs to
+ * temporary files which are merged afterwards. an empty table is then built bottom-up:
+ * packed leaves one after another, then each internal level on top of the one below.
+ * a table that has rows already gets the sorted rows inserted one by one.
+ * the index on a is built the same way, from its own sorted entries */
 
-    uint32_t leftpart_rightmost_id = *internal_node_right_child(sib_page); // 注意左侧节点的最右侧孩子指针将并为中间指针
-    for (int32_t i = 0; i < cur_size; ++i) {
-      void* dst = internal_node_cell(cur_page, sib_size + i);
-      void* src = internal_node_cell(cur_page, i);
-      memcpy(dst, src, INTERNAL_NODE_CELL_SIZE);
-    }
+#define LOAD_RUN_ROWS (1 << 20) // rows sorted in memory at once, 24MB
+#define LOAD_LINE_SIZE 256
 
-    for (int32_t i = 0; i < sib_size; ++i) {
-      void* dst = internal_node_cell(cur_page, i);
-      void* src = internal_node_cell(sib_page, i);
-      memcpy(dst, src, INTERNAL_NODE_CELL_SIZE);
-    }
+typedef struct {
+  char key[12];
+  uint32_t a; // the value, the end of b for the index on a
+  uint64_t seq; // line of the row, duplicates are kept in the order they were given
+} LoadRecord;
 
-    *internal_node_child(cur_page, sib_size) = leftpart_rightmost_id;
-    memset(sib_page, 0, PAGE_SIZE);
-  }
-  else {
-    // 左边 合并 右边
-    // printf("Not Merging By RightMost!!! Cur Size is %d\n", cur_size);
+typedef struct {
+  LoadRecord* records; // the last run, still in memory
+  uint32_t num_records;
+  uint32_t next_record;
+  uint64_t num_added; // records added so far
+  FILE** runs; // runs spilled to temporary files
+  uint32_t num_runs;
+  LoadRecord* heads; // next record of every run, the memory run is the last one
+  bool* has_head;
+} LoadSource;
 
-    for (int32_t i = 0; i < sib_size; ++i) {
-      memcpy(internal_node_cell(cur_page, cur_size + i), internal_node_cell(sib_page, i), INTERNAL_NODE_CELL_SIZE);
-    }
-    *internal_node_right_child(cur_page) = *internal_node_right_child(sib_page);
-    // memset(sib_page, 0, PAGE_SIZE);
+typedef struct {
+  uint32_t* pages; // the nodes of one level, left to right
+  char (*separators)[12]; // separators[i] lies between pages[i] and pages[i + 1]
+  uint32_t num_nodes;
+  uint32_t capacity;
+} LoadLevel;
+
+int compare_load_record (const void* a, const void* b) {
+  const LoadRecord* x = a;
+  const LoadRecord* y = b;
+  int cmp = key_compare(x->key, y->key);
+  if (cmp != 0) {
+    return cmp;
   }
-  
-  // last, check parent_node, if is root, meaning that internal nodes are merged
-  // leaving only one root node
-  if (parent_id == 0) {
-    // printf("Borrowed One From Root Node!\n");
-
-    int32_t parent_size = *internal_node_num_keys(parent_page);
-    // printf("After Borrowing, Root Has %d Keys.\n", parent_size);
-
-    if (parent_size <= 0) {
-      memcpy(parent_page, cur_page, PAGE_SIZE);
-      memset(cur_page, 0, PAGE_SIZE);
-      set_node_root(parent_page, true);
-
-      for (uint32_t i = 0; i < parent_size; ++i) {
-        void* temp_child = get_page(table->pager, *internal_node_child(parent_page, i));
-        *node_parent(temp_child) = parent_id;
-      }
+  return (x->seq > y->seq) - (x->seq < y->seq);
+}
 
-      void* rightmost_child = get_page(table->pager, *internal_node_right_child(parent_page));
-      *node_parent(rightmost_child) = parent_id;
-      // printf("Changing RootNode!\n"); // 整棵树的高度将下降1
-      return;
-    }
-    else {
-      return;
-    }
-  }
-  else {
-    // else, recursively check his parents
-    if (*internal_node_num_keys(parent_page) >= INTERNAL_NODE_MIN_CELLS) {
-      return;
-    }
-    else {
-      merge_or_redistribute(parent_page, parent_id, key_to_borrow_buf);
-      return;
-    }
+/* needed functions, the tokenizer of the shell */
+static inline char* next_token (char** line, uint32_t* length);
+static inline bool parse_column_a (const char* token, uint32_t* a);
+static inline bool parse_column_b (const char* token, uint32_t length, char* key);
+
+// parse one line of the input without its line end, false if it is not a valid row
+bool load_parse_line (char* line, LoadRecord* record) {
+  uint32_t a_length;
+  uint32_t b_length;
+  char* a = next_token(&line, &a_length);
+  if (a != NULL && a_length == 6 && memcmp(a, "insert", 6) == 0) {
+    a = next_token(&line, &a_length);
   }
-  // printf("Exited From Internal Node Merge!\n");
+  char* b = next_token(&line, &b_length);
+  return a != NULL && b != NULL && parse_column_a(a, &record->a) && parse_column_b(b, b_length, record->key);
 }
 
-/* 合并操作: 将src对应的节点数据 全部移植到dst */
-void leafnode_move_all_to(void* src, void* dst) {
-  uint32_t num_cells_in_src = *leaf_node_num_cells(src);
-  uint32_t start_in_dst = *leaf_node_num_cells(dst);
+void load_source_init (LoadSource* source) {
+  source->records = malloc(LOAD_RUN_ROWS * sizeof(LoadRecord));
+  source->num_records = 0;
+  source->next_record = 0;
+  source->num_added = 0;
+  source->runs = NULL;
+  source->num_runs = 0;
+}
 
-  for (int32_t i = 0; i < num_cells_in_src; ++i) {
-    memcpy(leaf_node_cell(dst, start_in_dst + i), leaf_node_cell(src, i), LEAF_NODE_CELL_SIZE);
+void load_add_record (LoadSource* source, LoadRecord* record) {
+  source->records[source->num_records] = *record;
+  source->num_added += 1;
+  if (++source->num_records < LOAD_RUN_ROWS) {
+    return;
   }
-  uint32_t num_cells_in_dst = *leaf_node_num_cells(dst);
-  *leaf_node_num_cells(dst) = num_cells_in_src + num_cells_in_dst;
-  *leaf_node_num_cells(src) = 0;
-
-  *leaf_node_next_leaf(dst) = *leaf_node_next_leaf(src);
-  *leaf_node_next_leaf(src) = 0;
 
+  // the run is full, sort it and move it out of memory
+  qsort(source->records, source->num_records, sizeof(LoadRecord), compare_load_record);
+  FILE* run = tmpfile();
+  if (run == NULL || fwrite(source->records, sizeof(LoadRecord), source->num_records, run) != source->num_records) {
+    printf("Error writing temporary run: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  rewind(run);
+  source->runs = realloc(source->runs, (source->num_runs + 1) * sizeof(FILE*));
+  source->runs[source->num_runs++] = run;
+  source->num_records = 0;
 }
 
-/* 合并两个叶子节点的算法 */
-void leafnode_merge (void* sib_page, void* cur_page, void* parent_page, uint32_t parent_id, char* key, bool rightmost) {
-  // printf("LeafNode Merging Type: [%d]\n", rightmost);
+// all records are added, sort the last run and get ready for load_next
+void load_source_sort (LoadSource* source) {
+  qsort(source->records, source->num_records, sizeof(LoadRecord), compare_load_record);
 
-  // 首先, 将节点合并
-  if (rightmost)
-    leafnode_move_all_to(cur_page, sib_page); // always returns leftside page, src -> dst
-  else
-    leafnode_move_all_to(sib_page, cur_page);
+  source->heads = malloc((source->num_runs + 1) * sizeof(LoadRecord));
+  source->has_head = malloc((source->num_runs + 1) * sizeof(bool));
+  for (uint32_t i = 0; i <= source->num_runs; ++i) {
+    source->has_head[i] = false;
+  }
+}
 
-  uint32_t key_index = internal_node_find_child(parent_page, key);
-  uint32_t key_num = *internal_node_num_keys(parent_page);
-  // printf("Key is: [%s], Key's index is [%d] and key_num is [%d]\n", key, key_index, key_num);
+// the entry of a row in the index on a
+void load_index_a_record (LoadRecord* row, LoadRecord* entry) {
+  index_a_key(row->a, row->key, entry->key);
+  entry->a = index_a_value(row->key);
+  entry->seq = row->seq;
+}
 
-  // 删除父结点中指向 被合并的页面(sib)的指针
-  if (key_index < key_num - 1) { // 一个小改动: key_index == key_num - 1, 就已经代表是最右key了
-    // 左侧&中间节点的情况
-    // 这里有问题? pointer[index]需要保留, 而被合并的右侧页面指针(pointer[index + 1]) 将会失效!!!
-    uint32_t child_reserve = *internal_node_child(parent_page, key_index);
-    // printf("Child is [%d]\n", child_reserve);
-    for (uint32_t i = key_index; i < key_num - 1; ++i) {
-      void* dst = internal_node_cell(parent_page, i);
-      void* src = internal_node_cell(parent_page, i + 1);
-      memcpy(dst, src, INTERNAL_NODE_CELL_SIZE);
-    }
-    *internal_node_child(parent_page, key_index) = child_reserve;
+/* read and sort the whole input, returns the number of rows. index_source (may be NULL) gets the index entries.
+ * lines that are no rows, too long ones included, are counted in num_rejected, empty lines are skipped */
+uint64_t load_sort_input (FILE* input, LoadSource* source, LoadSource* index_source, uint64_t* num_rejected) {
+  char line[LOAD_LINE_SIZE];
+  uint64_t num_rows = 0;
+  *num_rejected = 0;
+  load_source_init(source);
+  if (index_source) {
+    load_source_init(index_source);
   }
-  else {
-    // 最右侧页面被合并到左侧, 需要移除最右指针
-    if (key_num > 1) {
-      int32_t new_right_most_child = *internal_node_child(parent_page, key_index - 1);
-      // printf("After Merging, The new Child's Page Id is [%d]\n", new_right_most_child);
-      *internal_node_right_child(parent_page) = new_right_most_child;
+
+  while (fgets(line, sizeof(line), input) != NULL) {
+    size_t length = strlen(line);
+    bool complete = length > 0 && line[length - 1] == '\n';
+    if (!complete && !feof(input)) {
+      // cut off by the buffer, drop the rest of it too
+      int c;
+      while ((c = fgetc(input)) != '\n' && c != EOF);
+      *num_rejected += 1;
+      continue;
     }
-    else {
-      // printf("Removing only key in the parent node!\n");
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      line[--length] = 0;
     }
+    if (length == 0) {
+      continue;
+    }
+    LoadRecord record;
+    if (!load_parse_line(line, &record)) {
+      *num_rejected += 1;
+      continue;
+    }
+    record.seq = num_rows++;
+    load_add_record(source, &record);
+    if (index_source) {
+      LoadRecord entry;
+      load_index_a_record(&record, &entry);
+      load_add_record(index_source, &entry);
+    }
+  }
+  load_source_sort(source);
+  if (index_source) {
+    load_source_sort(index_source);
   }
+  return num_rows;
+}
 
-  // 只需要修改一下父结点中的键即可
-  *internal_node_num_keys(parent_page) = key_num - 1;
+bool load_run_next (LoadSource* source, uint32_t run, LoadRecord* record) {
+  if (run == source->num_runs) {
+    if (source->next_record == source->num_records) {
+      return false;
+    }
+    *record = source->records[source->next_record++];
+    return true;
+  }
+  return fread(record, sizeof(LoadRecord), 1, source->runs[run]) == 1;
+}
 
-  if (parent_id == 0) {
-    // 父结点就是根节点, 而当前合并了两个叶子
-    if (*internal_node_num_keys(parent_page) == 0) {
-      // 根节点空了
-      if (rightmost) {
-        memcpy(parent_page, sib_page, PAGE_SIZE);
-        *leaf_node_num_cells(sib_page) = 0;
-      }
-      else {
-        memcpy(parent_page, cur_page, PAGE_SIZE);
-        *leaf_node_num_cells(cur_page) = 0;
-      }
-      set_node_type(parent_page, NODE_LEAF);
-      set_node_root(parent_page, true);
-      *leaf_node_next_leaf(parent_page) = 0;
+// next row in sorted order, merged from all runs
+bool load_next (LoadSource* source, LoadRecord* record) {
+  int32_t smallest = -1;
+  for (uint32_t i = 0; i <= source->num_runs; ++i) {
+    if (!source->has_head[i]) {
+      source->has_head[i] = load_run_next(source, i, &source->heads[i]);
+    }
+    if (source->has_head[i] && (smallest < 0 || compare_load_record(&source->heads[i], &source->heads[smallest]) < 0)) {
+      smallest = i;
     }
   }
-  else {
-    merge_or_redistribute(parent_page, parent_id, key);
-    return;
+  if (smallest < 0) {
+    return false;
   }
+  *record = source->heads[smallest];
+  source->has_head[smallest] = false;
+  return true;
 }
 
-/* 判断节点下溢的情况选择合并 还是 重新分配的函数 */
-bool merge_or_redistribute (void* node, uint32_t node_id, char* key) {
-  // node: 当前的节点, 这里需要注意节点的类型, 是叶子还是内部!!!
-  // node_id: 当前节点ID
-  // key: 将要删除的键
+void load_close (LoadSource* source) {
+  for (uint32_t i = 0; i < source->num_runs; ++i) {
+    fclose(source->runs[i]);
+  }
+  free(source->runs);
+  free(source->records);
+  free(source->heads);
+  free(source->has_head);
+}
 
-  if (node_id == table->root_page_num) {
-    return adjust_root(node, node_id);
-  } 
-  
-  // 根据节点类型进行相应的判断
-  // 如果删除后节点数不发生下溢, 则直接返回
-  NodeType node_type = get_node_type(node);
-  switch (node_type) {
-    case NODE_LEAF: {
-      uint32_t num_cells_in_leaf = *leaf_node_num_cells(node);
-      if (num_cells_in_leaf >= LEAF_NODE_MAX_CELLS / 2) {
-        return false;
-      }
-      break;
-    }  
-    case NODE_INTERNAL: {
-      uint32_t num_cells_in_internal = *internal_node_num_keys(node);
-      // printf("Cur Internal Node has %d key(s)!\n", num_cells_in_internal);
-      if (num_cells_in_internal >= INTERNAL_NODE_MIN_CELLS) {
-        return false;
-      }
-      break;
-    }
+void load_push_node (LoadLevel* level, uint32_t page_num, char* separator) {
+  if (level->num_nodes == level->capacity) {
+    level->capacity = level->capacity ? level->capacity * 2 : 64;
+    level->pages = realloc(level->pages, level->capacity * sizeof(uint32_t));
+    level->separators = realloc(level->separators, level->capacity * sizeof(char[12]));
   }
+  level->pages[level->num_nodes] = page_num;
+  memcpy(level->separators[level->num_nodes], separator, INTERNAL_NODE_KEY_SIZE);
+  level->num_nodes += 1;
+}
 
-  // 否则, 需要进行合并 / 重新分配 
-  uint32_t parent_id = *node_parent(node);
-  void* parent_node = get_page(table->pager, parent_id);
-  if (!parent_node) {
-    printf("Error! Tried to access a NULL page!\n");
-    exit(EXIT_FAILURE);
+// put the rows of one key behind the last cell of the leaf being filled, a full leaf is closed first
+void load_append_key (LoadLevel* leaves, uint32_t* leaf_page_num, char* key, uint32_t* values, uint32_t count, uint32_t overflow_head) {
+  Pager* pager = table->pager;
+  uint16_t posting_count = overflow_head ? POSTING_OVERFLOW : count;
+  uint32_t posting[LEAF_NODE_MAX_POSTING];
+  if (overflow_head) {
+    posting[0] = overflow_head;
+  }
+  for (uint32_t i = 0; i < count && !overflow_head; ++i) {
+    posting[i] = values[count - 1 - i]; // newest first
   }
 
-  uint32_t sib_node_id;
-  void* sib_node;
-  bool is_redistribute = false;
-  bool to_be_merge;
-  bool rightmost;
-  uint32_t child_index = internal_node_find_child(parent_node, key);
-  // printf("Child index is %d\n", child_index);
+  void* leaf = get_page(pager, *leaf_page_num);
+  mark_page_dirty(pager, *leaf_page_num);
+  // the leaf has no holes, taking a shorter prefix already made sure the cell fits
+  if (!leaf_node_take_prefix(leaf, key, posting_count)
+      || leaf_node_free_space(leaf) < leaf_cell_size(leaf_node_suffix_size(leaf), posting_count)) {
+    char max_key[LEAF_NODE_KEY_SIZE];
+    char separator[LEAF_NODE_KEY_SIZE];
+    leaf_node_get_key(leaf, *leaf_node_num_cells(leaf) - 1, max_key);
+    key_separator(max_key, key, separator);
+    uint32_t next_page_num = get_unused_page_num(pager);
+    *leaf_node_next_leaf(leaf) = next_page_num;
+    load_push_node(leaves, *leaf_page_num, separator);
+    unpin_page(pager, *leaf_page_num);
+
+    *leaf_page_num = next_page_num;
+    leaf = get_page(pager, *leaf_page_num);
+    mark_page_dirty(pager, *leaf_page_num);
+    initialize_leaf_node(leaf);
+    leaf_node_take_prefix(leaf, key, posting_count);
+  }
+  leaf_node_append_cell(leaf, key, posting_count, posting);
+  unpin_page(pager, *leaf_page_num);
+}
 
-  if (node_type == NODE_LEAF) {
-    // 当前待合并/重新分配的节点是叶子节点   
-    // 找它的兄弟节点(在同一父结点下才是兄弟节点)
-    uint32_t num_child_in_parent = *internal_node_num_keys(parent_node);
-    if (child_index == num_child_in_parent) {
-      // rightmost leaf node
-      sib_node_id = *internal_node_child(parent_node, num_child_in_parent - 1);
-      rightmost = true;
+// build the tree of an empty table (or index) from the sorted rows
+void load_build_tree (Table* table, LoadSource* source) {
+  Pager* pager = table->pager;
+  LoadLevel level = {0};
+
+  // 1. leaves, the empty root leaf becomes the first one
+  uint32_t leaf_page_num = table->root_page_num;
+  uint32_t values[LEAF_NODE_MAX_POSTING];
+  uint32_t count = 0;
+  uint32_t overflow_head = 0;
+  LoadRecord record;
+  LoadRecord last;
+  bool more = load_next(source, &record);
+  while (more) {
+    last = record;
+    if (count == LEAF_NODE_MAX_POSTING || overflow_head) {
+      // too many rows for the leaf, they go to overflow pages (oldest first)
+      if (overflow_head == 0) {
+        overflow_head = get_unused_page_num(pager);
+        void* overflow = get_page(pager, overflow_head);
+        mark_page_dirty(pager, overflow_head);
+        initialize_overflow_node(overflow);
+        unpin_page(pager, overflow_head);
+        for (uint32_t i = 0; i < count; ++i) {
+          overflow_head = overflow_append(pager, overflow_head, values[i]);
+        }
+      }
+      overflow_head = overflow_append(pager, overflow_head, record.a);
     }
     else {
-      // not the rightmost, so direct next is th sibling
-      sib_node_id = *leaf_node_next_leaf(node);
-      rightmost = false;
+      values[count++] = record.a;
     }
-    
-    sib_node = get_page(table->pager, sib_node_id);
-    uint32_t sib_num_cells = *leaf_node_num_cells(sib_node);
-    uint32_t cur_num_cells = *leaf_node_num_cells(node);
-    if (sib_num_cells >= 1 + LEAF_NODE_MIN_CELLS) {
-      is_redistribute = true;
-      to_be_merge = false;
+
+    more = load_next(source, &record);
+    if (!more || key_compare(record.key, last.key) != 0) {
+      load_append_key(&level, &leaf_page_num, last.key, values, count, overflow_head);
+      count = 0;
+      overflow_head = 0;
     }
   }
-  else {
-    // 当前待分配的节点是内部节点
-    uint32_t cur_node_index_in_parent = internal_node_find_child(parent_node, key);
-    uint32_t num_child_in_parent = *internal_node_num_keys(parent_node);
-    // printf("Parent has %d keys, while Cur Node index in parent is %d\n", num_child_in_parent, cur_node_index_in_parent);
-    if (cur_node_index_in_parent >= num_child_in_parent) {
-      sib_node_id = *internal_node_child(parent_node, cur_node_index_in_parent - 1);
-      rightmost = true;
+  void* leaf = get_page(pager, leaf_page_num);
+  if (*leaf_node_num_cells(leaf) > 0) {
+    char no_separator[12] = {0};
+    load_push_node(&level, leaf_page_num, no_separator);
+  }
+  unpin_page(pager, leaf_page_num);
+
+  // 2. internal levels, a node takes children as long as their separators fit,
+  //    the last two nodes of a level share theirs evenly
+  while (level.num_nodes > 1) {
+    uint32_t* starts = malloc(level.num_nodes * sizeof(uint32_t)); // first child of every node
+    uint32_t num_parents = 0;
+    for (uint32_t first = 0; first < level.num_nodes; ) {
+      uint32_t num_keys = 0;
+      uint32_t longest = 0;
+      while (first + num_keys + 1 < level.num_nodes) {
+        uint32_t length = key_length(level.separators[first + num_keys]);
+        length = length > longest ? length : longest;
+        uint32_t prefix_length = key_common_prefix(level.separators[first], level.separators[first + num_keys], INTERNAL_NODE_KEY_SIZE);
+        uint32_t cell_size = INTERNAL_NODE_CHILD_SIZE + (length > prefix_length ? length - prefix_length : 0);
+        if ((num_keys + 1) * cell_size > INTERNAL_NODE_SPACE_FOR_CELLS) {
+          break;
+        }
+        longest = length;
+        num_keys += 1;
+      }
+      starts[num_parents++] = first;
+      first += num_keys + 1;
     }
-    else {
-      sib_node_id = *internal_node_child(parent_node, cur_node_index_in_parent + 1);
-      rightmost = false;
+    if (num_parents > 1 && level.num_nodes - starts[num_parents - 2] > 3) {
+      uint32_t first = starts[num_parents - 2];
+      starts[num_parents - 1] = first + 1 + internal_node_even_split(level.separators + first, level.num_nodes - first - 1);
     }
-    sib_node = get_page(table->pager, sib_node_id);
 
-    uint32_t sib_num_cells = *internal_node_num_keys(sib_node);
-    uint32_t cur_num_cells = *internal_node_num_keys(node);
-
-    if (sib_num_cells >= 1 + INTERNAL_NODE_MIN_CELLS) {
-      is_redistribute = true;
-      to_be_merge = false;
+    LoadLevel parents = {0};
+    for (uint32_t p = 0; p < num_parents; ++p) {
+      uint32_t first = starts[p];
+      uint32_t last_child = p + 1 < num_parents ? starts[p + 1] - 1 : level.num_nodes - 1;
+      uint32_t page_num = get_unused_page_num(pager);
+      void* node = get_page(pager, page_num);
+      mark_page_dirty(pager, page_num);
+      initialize_internal_node(node);
+      internal_node_pack(node, level.pages + first, level.separators + first, last_child - first);
+      unpin_page(pager, page_num);
+      load_push_node(&parents, page_num, level.separators[last_child]);
     }
+    free(starts);
+    free(level.pages);
+    free(level.separators);
+    level = parents;
   }
 
+  if (level.num_nodes == 1 && level.pages[0] != table->root_page_num) {
+    void* old_root = get_page(pager, table->root_page_num);
+    mark_page_dirty(pager, table->root_page_num);
+    set_node_root(old_root, false);
+    unpin_page(pager, table->root_page_num);
 
-  if (is_redistribute) {
-    if (node_type == NODE_LEAF) {
-      leaf_redistribute(node, sib_node, parent_node, child_index);
-    }
-    else {
-      internalnode_redistribute(node, sib_node, parent_node, child_index, rightmost);
-    }
-    return false;
+    void* root = get_page(pager, level.pages[0]);
+    mark_page_dirty(pager, level.pages[0]);
+    set_node_root(root, true);
+    unpin_page(pager, level.pages[0]);
+    table->root_page_num = level.pages[0];
   }
+  free(level.pages);
+  free(level.separators);
+}
 
-  if (node_type == NODE_LEAF) {
-    // printf("Leaf Node Merging! Sib is [%d], and Cur is [%d]\n", sib_node_id, node_id);
-    leafnode_merge(sib_node, node, parent_node, parent_id, key, rightmost);
-    return true;
+void bulk_load (const char* filename) {
+  FILE* input = fopen(filename, "r");
+  if (input == NULL) {
+    printf("Unable to open file '%s'.\n", filename);
+    return;
+  }
+  void* root = get_page(table->pager, table->root_page_num);
+  bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+  unpin_page(table->pager, table->root_page_num);
+
+  // the index of an empty table is empty too, it is built next to the table
+  LoadSource source;
+  LoadSource index_source;
+  bool build_index = empty && index_a;
+  uint64_t num_rejected;
+  uint64_t num_rows = load_sort_input(input, &source, build_index ? &index_source : NULL, &num_rejected);
+  fclose(input);
+
+  if (empty) {
+    table->append_hint_valid = false;
+    load_build_tree(table, &source);
+    table->num_rows += num_rows;
   }
   else {
-    // printf("Internal Node Merging! Sib is [%d], and Cur is [%d]\n", sib_node_id, node_id);
-    internalnode_merge(sib_node, node, parent_node, parent_id, key, rightmost);
-    return true;
+    LoadRecord record;
+    while (load_next(&source, &record)) {
+      statement.row.a = record.a;
+      memcpy(statement.row.b, record.key, sizeof(statement.row.b));
+      b_tree_insert();
+    }
+  }
+  load_close(&source);
+  if (build_index) {
+    index_a->append_hint_valid = false;
+    load_build_tree(index_a, &index_source);
+    load_close(&index_source);
+  }
+  printf("Loaded %" PRIu64 " rows.\n", num_rows);
+  if (num_rejected > 0) {
+    printf("Rejected %" PRIu64 " lines that are not rows.\n", num_rejected);
   }
-  
-  return to_be_merge;
 }
 
-/* 实现 叶子节点内部的关键值删除 */
-bool leaf_node_delete (uint32_t page_id, uint32_t cell_num, char* keys_to_delete) {
-  // printf("Find key in Page [%d], cell num is [%d]\n", page_id, cell_num);
+// PostingVisitor adding the index entry of a table row to a LoadSource
+void load_add_index_a_entry (char* key, uint32_t value, void* arg) {
+  LoadSource* source = arg;
+  LoadRecord row;
+  memcpy(row.key, key, sizeof(row.key));
+  row.a = value;
+  row.seq = table->num_rows - source->num_added; // rows are visited newest first
+  LoadRecord entry;
+  load_index_a_record(&row, &entry);
+  load_add_record(source, &entry);
+}
 
-  // 当前执行删除的叶子节点
-  void* node = get_page(table->pager, page_id);
-  if (!node) {
-    return false;
+/* `.index a` creates the index on column a and fills it with the rows already in the table */
+void create_index_a () {
+  if (index_a) {
+    printf("Index on a exists already.\n");
+    return;
   }
-  // printf("Successfully fetched page with %d keys\n", *leaf_node_num_cells(node));
-  // 当前叶子节点拥有的键数
-  uint32_t leaf_num_cells = *leaf_node_num_cells(node);
-  uint32_t index = cell_num;
+  uint32_t root_page_num = get_unused_page_num(table->pager);
+  void* root = get_page(table->pager, root_page_num);
+  mark_page_dirty(table->pager, root_page_num);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+  unpin_page(table->pager, root_page_num);
+  index_a = table_open(table->pager, root_page_num);
+
+  LoadSource source;
+  load_source_init(&source);
+  Cursor cursor;
+  table_start(table, &cursor);
+  while (!(cursor.end_of_table)) {
+    void* node = get_page(table->pager, cursor.page_num);
+    posting_for_each(table->pager, node, cursor.cell_num, load_add_index_a_entry, &source);
+    unpin_page(table->pager, cursor.page_num);
+    cursor_advance(&cursor);
+  }
+  load_source_sort(&source);
+  load_build_tree(index_a, &source);
+  load_close(&source);
+  printf("Indexed %" PRIu64 " rows.\n", table->num_rows);
+}
 
-  // 判断!找到的位置与待删除的键进行比较, 如果不一样, 说明已经不存在未删除的键, 直接返回
-  char* key_at_index = leaf_node_key(node, index); 
-  // printf("Keys to delete is %s, while key at index is %s, Index is %d\n", keys_to_delete, key_at_index, index);
-  if (strcmp(key_at_index, keys_to_delete) != 0 || leaf_num_cells == 0 || cell_num == leaf_num_cells) {
-    return false;
+/*---------------------------------------------*/
+
+/*---------- Statistics --------------*/
+
+/* `.stats` reports how many statements of each kind ran and how long they took, the pager's
+ * reads, writes, hits and misses and how the trees changed shape. latencies go into log-linear
+ * buckets like an HDR histogram: exact below 16ns, then 16 buckets for every power of two,
+ * so a percentile is off by at most 1/16 */
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+LatencyHistogram statement_latency[3]; // indexed by StatementType
+
+uint64_t now_ns () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t latency_bucket (uint64_t ns) {
+  if (ns < LATENCY_SUB_BUCKETS) {
+    return ns;
   }
-  
-  memset(leaf_node_cell(node, index), 0, LEAF_NODE_CELL_SIZE);
-  for (int32_t i = index; i < leaf_num_cells - 1; ++i) {
-    void* dest = leaf_node_cell(node, i);
-    void* src = leaf_node_cell(node, i + 1);
-    memcpy(dest, src, LEAF_NODE_CELL_SIZE);
-  }
-  leaf_num_cells -= 1;
-  *leaf_node_num_cells(node) = leaf_num_cells;
-  
-  merge_or_redistribute(node, page_id, keys_to_delete);
-  return true;   
+  uint32_t high_bit = 63 - __builtin_clzll(ns);
+  uint32_t shift = high_bit - LATENCY_SUB_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + ((ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
 }
 
-/* the key to delete is stored in `statement.row.b` */
-void b_tree_delete() {
-  /* delete row(s) */  
-  char* keys_to_delete = statement.row.b;
+// largest latency that falls into bucket
+uint64_t latency_bucket_end (uint32_t bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  uint32_t shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  uint64_t sub_bucket = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+  return ((sub_bucket + 1) << shift) - 1;
+}
 
-  /* Memory Leak! */
-  while (true) {
-    Cursor* cursor = table_find(table, keys_to_delete);
-    if (cursor->end_of_table) {
-      free(cursor);
-      break;
-    }
-    else {
-      bool test_ans = leaf_node_delete(cursor->page_num, cursor->cell_num, keys_to_delete);
-      if (!test_ans) {
-        free(cursor);
-        break;
-      }
-      else {
-        free(cursor);
-      }
+void latency_record (LatencyHistogram* histogram, uint64_t ns) {
+  histogram->count += 1;
+  histogram->total_ns += ns;
+  if (ns > histogram->max_ns) {
+    histogram->max_ns = ns;
+  }
+  histogram->buckets[latency_bucket(ns)] += 1;
+}
+
+// the latency quantile (0 to 1) of the statements fall below
+uint64_t latency_percentile (LatencyHistogram* histogram, double quantile) {
+  uint64_t rank = (uint64_t)(quantile * histogram->count + 0.999999);
+  rank = rank == 0 ? 1 : rank;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint64_t end = latency_bucket_end(i);
+      return end < histogram->max_ns ? end : histogram->max_ns;
     }
   }
+  return histogram->max_ns;
+}
 
+// levels of the tree, a single leaf has height 1
+uint32_t tree_height (Table* tree) {
+  uint32_t height = 1;
+  uint32_t page_num = tree->root_page_num;
+  void* node = get_page(tree->pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t child_page_num = *internal_node_child(node, 0);
+    unpin_page(tree->pager, page_num);
+    page_num = child_page_num;
+    node = get_page(tree->pager, page_num);
+    height += 1;
+  }
+  unpin_page(tree->pager, page_num);
+  return height;
 }
 
-void b_tree_traverse() {
-  /* print all rows */
-  Row row;
-  Cursor* cursor = table_start(table);
-  if (cursor->end_of_table) {
-    printf("(Empty)\n");
+void print_stats () {
+  const char* names[3] = {"insert", "select", "delete"};
+  printf("statement  count       mean      p50      p90      p99    p99.9      max (ns)\n");
+  for (uint32_t i = 0; i < 3; ++i) {
+    LatencyHistogram* histogram = &statement_latency[i];
+    printf("%-9s %6" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+           names[i], histogram->count, histogram->count ? histogram->total_ns / histogram->count : 0,
+           latency_percentile(histogram, 0.5), latency_percentile(histogram, 0.9),
+           latency_percentile(histogram, 0.99), latency_percentile(histogram, 0.999), histogram->max_ns);
+  }
+  printf("pages: %u in file, %" PRIu64 " read, %" PRIu64 " written\n", table->pager->num_pages,
+         stats.page_reads, stats.page_writes);
+  if (table->pager->map_) {
+    printf("cache: file is mapped, the pool is not used\n");
   }
   else {
-    while (!(cursor->end_of_table)) {
-      deserialize_row(cursor_value(cursor), &row);
-      print_row(&row);
-      cursor_advance(cursor);
-    }
+    uint64_t fetches = stats.cache_hits + stats.cache_misses;
+    printf("cache: %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate), %u frames\n", stats.cache_hits, stats.cache_misses,
+           fetches ? 100.0 * stats.cache_hits / fetches : 0.0, table->pager->num_frames);
   }
-  free(cursor);
-  return;
+  printf("tree: %" PRIu64 " leaf splits, %" PRIu64 " internal splits, %" PRIu64 " merges, %" PRIu64 " redistributions\n",
+         stats.leaf_splits, stats.internal_splits, stats.merges, stats.redistributions);
+  if (wal.fd != -1) {
+    printf("wal: %" PRIu64 " syncs, %" PRIu64 " checkpoints, %" PRIu64 " pages spilled\n",
+           stats.wal_syncs, stats.checkpoints, stats.page_spills);
+  }
+  printf("height: %u", tree_height(table));
+  if (index_a) {
+    printf(", index on a %u", tree_height(index_a));
+  }
+  printf("\n");
 }
 
+/*---------------------------------------------*/
+
 /* logic starts */
 
 void print_constants() {
@@ -1761,6 +3780,7 @@ void print_constants() {
   printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
   printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
   printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+  printf("LEAF_NODE_MAX_POSTING: %d\n", LEAF_NODE_MAX_POSTING);
 }
 
 typedef enum {
@@ -1785,88 +3805,191 @@ typedef enum {
 
 MetaCommandResult do_meta_command() {
   if (strcmp(input_buffer.buffer, ".exit") == 0) {
+    clean_exit = true;
     exit(EXIT_SUCCESS);
   } else if (strcmp(input_buffer.buffer, ".constants") == 0) {
     printf("Constants:\n");
     print_constants();
     return META_COMMAND_SUCCESS;    
+  } else if (strncmp(input_buffer.buffer, ".load ", 6) == 0) {
+    bulk_load(input_buffer.buffer + 6);
+    wal_checkpoint(table); // loaded rows are not logged one by one
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer.buffer, ".index a") == 0) {
+    create_index_a();
+    wal_checkpoint(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer.buffer, ".stats") == 0) {
+    print_stats();
+    return META_COMMAND_SUCCESS;
   } else {
     return META_COMMAND_UNRECOGNIZED_COMMAND;
   }
 }
 
-PrepareResult prepare_insert() {
+/* statements are parsed in one pass over input_buffer, nothing is allocated or copied but
+ * the values that end up in `statement`. tokens are separated by spaces like strtok would */
+
+// the token at *line or behind it, NULL if there is none. *line moves behind the token
+static inline char* next_token (char** line, uint32_t* length) {
+  char* p = *line;
+  while (*p == ' ') {
+    ++p;
+  }
+  char* token = p;
+  while (*p != ' ' && *p != 0) {
+    ++p;
+  }
+  *length = p - token;
+  *line = p;
+  return *length > 0 ? token : NULL;
+}
+
+/* column a, read like atoi does: an optional sign and the digits in front of anything else.
+ * returns false if it is negative */
+static inline bool parse_column_a (const char* token, uint32_t* a) {
+  const char* p = token;
+  while (*p >= '\t' && *p <= '\r') {
+    ++p;
+  }
+  bool negative = *p == '-';
+  if (*p == '-' || *p == '+') {
+    ++p;
+  }
+  uint32_t value = 0;
+  while (*p >= '0' && *p <= '9') {
+    value = value * 10 + (*p++ - '0');
+  }
+  int32_t x = negative ? -(int32_t)value : (int32_t)value;
+  *a = x;
+  return x >= 0;
+}
+
+// copy a token of column b zero padded to key, false if it is too long
+static inline bool parse_column_b (const char* token, uint32_t length, char* key) {
+  if (length > COLUMN_B_SIZE) {
+    return false;
+  }
+  memset(key, 0, COLUMN_B_SIZE + 1); // zero padded, keys are compared as integers
+  memcpy(key, token, length);
+  return true;
+}
+
+PrepareResult prepare_insert(char* line) {
   statement.type = STATEMENT_INSERT;
 
-  char* keyword = strtok(input_buffer.buffer, " ");
-  char* a = strtok(NULL, " ");
-  char* b = strtok(NULL, " ");
-  int x;
+  uint32_t a_length;
+  uint32_t b_length;
+  char* a = next_token(&line, &a_length);
+  char* b = next_token(&line, &b_length);
 
   if (a == NULL || b == NULL)
     return PREPARE_SYNTAX_ERROR;
 
-  x = atoi(a);
-  if (x < 0)
+  if (!parse_column_a(a, &statement.row.a))
     return PREPARE_NEGATIVE_VALUE;
-  if (strlen(b) > COLUMN_B_SIZE)
+  if (!parse_column_b(b, b_length, statement.row.b))
     return PREPARE_STRING_TOO_LONG;
 
-  statement.row.a = x;
-  strcpy(statement.row.b, b);
-
   return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_condition() {
+PrepareResult prepare_condition(char* line) {
   statement.flag = 0;
 
-  char* keyword = strtok(input_buffer.buffer, " ");
-  char* b = strtok(NULL, " ");
-  char* c = strtok(NULL, " ");
+  uint32_t b_length;
+  uint32_t c_length;
+  char* b = next_token(&line, &b_length);
+  char* c = next_token(&line, &c_length);
 
   if (b == NULL) return PREPARE_SUCCESS;
-  if (c != NULL) return PREPARE_SYNTAX_ERROR;
 
-  if (strlen(b) > COLUMN_B_SIZE)
-    return PREPARE_STRING_TOO_LONG;
+  // `<lo> <hi>` selects a range of b
+  if (c != NULL) {
+    uint32_t length;
+    if (next_token(&line, &length) != NULL)
+      return PREPARE_SYNTAX_ERROR;
+    if (!parse_column_b(b, b_length, statement.row.b) || !parse_column_b(c, c_length, statement.hi))
+      return PREPARE_STRING_TOO_LONG;
+    statement.flag |= 4;
+    return PREPARE_SUCCESS;
+  }
+
+  // `a=<n>` selects by column a
+  if (b[0] == 'a' && b[1] == '=') {
+    if (!parse_column_a(b + 2, &statement.row.a))
+      return PREPARE_NEGATIVE_VALUE;
+    statement.flag |= 1;
+    return PREPARE_SUCCESS;
+  }
 
-  strcpy(statement.row.b, b);
+  // `<prefix>*` selects the keys starting with prefix
+  if (b[b_length - 1] == '*') {
+    if (!parse_column_b(b, b_length - 1, statement.row.b))
+      return PREPARE_STRING_TOO_LONG;
+    statement.flag |= 8;
+    return PREPARE_SUCCESS;
+  }
+
+  if (!parse_column_b(b, b_length, statement.row.b))
+    return PREPARE_STRING_TOO_LONG;
   statement.flag |= 2;
 
   return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_select() {
+PrepareResult prepare_select(char* line) {
   statement.type = STATEMENT_SELECT;
-  return prepare_condition();
+  return prepare_condition(line);
 }
 
-PrepareResult prepare_delete() {
+PrepareResult prepare_delete(char* line) {
   statement.type = STATEMENT_DELETE;
-  PrepareResult result = prepare_condition();
-  if (result == PREPARE_SUCCESS && statement.flag == 0)
+  PrepareResult result = prepare_condition(line);
+  if (result == PREPARE_SUCCESS && (statement.flag & 2) == 0) // rows are only deleted by b
     return PREPARE_SYNTAX_ERROR;
   return result;
 }
 
+// the keyword is told by its first byte, whatever follows the 6 letters up to a space is ignored
 PrepareResult prepare_statement() {
-  if (strlen(input_buffer.buffer) == 0) {
-    return PREPARE_EMPTY_STATEMENT;
-  } else if (strncmp(input_buffer.buffer, "insert", 6) == 0) {
-    return prepare_insert();
-  } else if (strncmp(input_buffer.buffer, "select", 6) == 0) {
-    return prepare_select();
-  } else if (strncmp(input_buffer.buffer, "delete", 6) == 0) {
-    return prepare_delete();
+  char* line = input_buffer.buffer;
+  uint32_t length;
+  switch (line[0]) {
+    case 0:
+      return PREPARE_EMPTY_STATEMENT;
+    case 'i':
+      if (memcmp(line, "insert", 6) == 0) {
+        next_token(&line, &length);
+        return prepare_insert(line);
+      }
+      break;
+    case 's':
+      if (memcmp(line, "select", 6) == 0) {
+        next_token(&line, &length);
+        return prepare_select(line);
+      }
+      break;
+    case 'd':
+      if (memcmp(line, "delete", 6) == 0) {
+        next_token(&line, &length);
+        return prepare_delete(line);
+      }
+      break;
   }
   return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
 ExecuteResult execute_select() {
-  printf("\n");
+  if (!batch_mode) {
+    printf("\n");
+  }
   if (statement.flag == 0) {
     b_tree_traverse();
+  } else if (statement.flag & 1) {
+    b_tree_search_a();
+  } else if (statement.flag & (4 | 8)) {
+    b_tree_search_range();
   } else {
     b_tree_search();
   }
@@ -1876,18 +3999,33 @@ ExecuteResult execute_select() {
 ExecuteResult execute_statement() {
   switch (statement.type) {
     case STATEMENT_INSERT:
+      wal_log(WAL_INSERT, statement.row.a, statement.row.b);
       b_tree_insert();
       return EXECUTE_SUCCESS;
     case STATEMENT_SELECT:
       return execute_select();
     case STATEMENT_DELETE:
+      wal_log(WAL_DELETE, 0, statement.row.b);
       b_tree_delete();
       return EXECUTE_SUCCESS;
   }
 }
 
+// a statement replayed from the log
+void wal_apply (uint32_t type, uint32_t a, char* b) {
+  statement.row.a = a;
+  memcpy(statement.row.b, b, sizeof(statement.row.b));
+  if (type == WAL_INSERT) {
+    b_tree_insert();
+  }
+  else {
+    b_tree_delete();
+  }
+}
+
 void sigint_handler(int signum) {
   printf("\n");
+  clean_exit = true;
   exit(EXIT_SUCCESS);
 }
 
@@ -1897,6 +4035,32 @@ int main(int argc, char* argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  for (int i = 2; i < argc; ++i) {
+    if (strncmp(argv[i], "--frames=", 9) == 0 && atoi(argv[i] + 9) > 0) {
+      pool_frames = atoi(argv[i] + 9);
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      use_mmap = true;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      batch_mode = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats_at_close = true;
+    } else if (strcmp(argv[i], "--no-wal") == 0) {
+      use_wal = false;
+    } else if (strncmp(argv[i], "--wal-batch=", 12) == 0 && atoi(argv[i] + 12) > 0) {
+      wal_batch = atoi(argv[i] + 12);
+    } else if (strncmp(argv[i], "--wal-interval=", 15) == 0 && atoi(argv[i] + 15) >= 0) {
+      wal_interval_ms = atoi(argv[i] + 15);
+    } else {
+      printf("Unknown option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // input from a file or a pipe: the output goes out in large blocks as well
+  if (batch_mode || !isatty(STDIN_FILENO)) {
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+  }
+
   atexit(&exit_success);
   signal(SIGINT, &sigint_handler);
 
@@ -1942,9 +4106,16 @@ int main(int argc, char* argv[]) {
         continue;
     }
 
-    switch (execute_statement()) {
+    // a statement takes as long as the syncs and checkpoints it sets off
+    uint64_t start = now_ns();
+    ExecuteResult result = execute_statement();
+    wal_statement_done(table);
+    latency_record(&statement_latency[statement.type], now_ns() - start);
+    switch (result) {
       case EXECUTE_SUCCESS:
-        printf("\nExecuted.\n\n");
+        if (!batch_mode) {
+          printf("\nExecuted.\n\n");
+        }
         break;
     }
   }
@@ -0,0 +1,226 @@
+/* Crash tests of the write-ahead log of myjql */
+/* Compile: gcc -o waltest waltest.c */
+/* Run: ./waltest */
+
+/* myjql.c is compiled in with its main renamed, every session runs in a child process on
+ * waltest.db. the system calls a session writes the db file with go through the fault_
+ * functions below, they end the session like a crash (_exit, nothing is cleaned up):
+ * at the end of its input, or in the middle of the n-th write to the db file. they can also
+ * fail the n-th read of the db file, myjql gives up on that error.
+ * after every crash or error the db is opened once more and has to hold every committed row */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define CRASH_EXIT 99 // exit status of a session that was crashed
+
+bool crash_at_eof = false; // crash instead of seeing the end of stdin, everything read is committed
+int32_t writes_left = -1; // writes to the db file before the crash, -1: none
+int32_t reads_left = -1; // reads of the db file before one fails, -1: none
+
+void crash () {
+  _exit(CRASH_EXIT);
+}
+
+ssize_t fault_read (int fd, void* buf, size_t count) {
+  if (fd != STDIN_FILENO && reads_left >= 0 && reads_left-- == 0) {
+    errno = EIO;
+    return -1;
+  }
+  ssize_t result = read(fd, buf, count);
+  if (fd == STDIN_FILENO && result == 0 && crash_at_eof) {
+    crash();
+  }
+  return result;
+}
+
+// the write the session crashes in gets half of its bytes out, or its first page of several
+ssize_t fault_pwrite (int fd, const void* buf, size_t count, off_t offset) {
+  if (writes_left == 0) {
+    pwrite(fd, buf, count / 2, offset);
+    crash();
+  }
+  if (writes_left > 0) {
+    --writes_left;
+  }
+  return pwrite(fd, buf, count, offset);
+}
+
+ssize_t fault_pwritev (int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+  if (writes_left == 0) {
+    if (iovcnt > 1) {
+      pwritev(fd, iov, 1, offset);
+    }
+    else {
+      pwrite(fd, iov[0].iov_base, iov[0].iov_len / 2, offset);
+    }
+    crash();
+  }
+  if (writes_left > 0) {
+    --writes_left;
+  }
+  return pwritev(fd, iov, iovcnt, offset);
+}
+
+#define read fault_read
+#define pwrite fault_pwrite
+#define pwritev fault_pwritev
+#define main myjql_main
+#include "myjql.c"
+#undef main
+#undef read
+#undef pwrite
+#undef pwritev
+
+#define DB_FILE "waltest.db"
+#define NUM_ROWS 3000
+
+/*---------- Sessions --------------*/
+
+void remove_db () {
+  unlink(DB_FILE);
+  unlink(DB_FILE "-wal");
+}
+
+// run myjql on the db with input as stdin and stdout going to output, returns the exit status
+int run_session (const char* input, const char* output, bool eof_crash, int32_t crash_writes, int32_t failing_read) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    crash_at_eof = eof_crash;
+    writes_left = crash_writes;
+    reads_left = failing_read;
+    int in = open(input, O_RDONLY);
+    int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (in == -1 || out == -1) {
+      _exit(EXIT_FAILURE);
+    }
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    char* argv[] = {"myjql", DB_FILE, "--batch", NULL};
+    myjql_main(3, argv);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void write_file (const char* filename, const char* content) {
+  FILE* file = fopen(filename, "w");
+  fputs(content, file);
+  fclose(file);
+}
+
+// true if the two files hold the same bytes
+bool same_files (const char* a, const char* b) {
+  FILE* x = fopen(a, "r");
+  FILE* y = fopen(b, "r");
+  int c, d;
+  do {
+    c = fgetc(x);
+    d = fgetc(y);
+  } while (c == d && c != EOF);
+  fclose(x);
+  fclose(y);
+  return c == d;
+}
+
+/*---------- Tests --------------*/
+
+/* the rows are only in the log when the session crashes, garbage is appended to the log as if
+ * the crash tore a record. the open recovering the rows is crashed in each of its writes to
+ * the db file in turn, the open after it has to recover them all the same */
+bool test_torn_tail () {
+  uint32_t crash_points = 0;
+  for (int32_t k = 0; ; ++k) {
+    remove_db();
+    if (run_session("waltest_rows.txt", "waltest_out.txt", true, -1, -1) != CRASH_EXIT) {
+      printf("torn tail: the session writing the rows did not crash\n");
+      return false;
+    }
+    FILE* log = fopen(DB_FILE "-wal", "a");
+    fputs("garbage bytes!", log);
+    fclose(log);
+
+    int status = run_session("waltest_empty.txt", "waltest_out.txt", false, k, -1);
+    if (run_session("waltest_select.txt", "waltest_out.txt", false, -1, -1) != 0
+        || !same_files("waltest_out.txt", "waltest_expected.txt")) {
+      printf("torn tail: rows lost after crashing recovery in db write %d\n", k);
+      return false;
+    }
+    if (status != CRASH_EXIT) {
+      break; // recovery got through without reaching write k
+    }
+    crash_points += 1;
+  }
+  printf("torn tail: ok, recovery crashed at %u points\n", crash_points);
+  return true;
+}
+
+/* half of the rows are in the db file, the other half only in the log when the session crashes.
+ * the open replaying them fails on each of its reads of the db file in turn. the tree it
+ * leaves behind must not reach the db file and the log must stay, the next open recovers */
+bool test_failed_replay () {
+  uint32_t failure_points = 0;
+  for (int32_t k = 0; ; ++k) {
+    remove_db();
+    run_session("waltest_rows.txt", "waltest_out.txt", false, -1, -1);
+    if (run_session("waltest_more.txt", "waltest_out.txt", true, -1, -1) != CRASH_EXIT) {
+      printf("failed replay: the session writing the rows did not crash\n");
+      return false;
+    }
+
+    int status = run_session("waltest_empty.txt", "waltest_out.txt", false, -1, k);
+    if (run_session("waltest_select.txt", "waltest_out.txt", false, -1, -1) != 0
+        || !same_files("waltest_out.txt", "waltest_all.txt")) {
+      printf("failed replay: rows lost after failing read %d of the replay\n", k);
+      return false;
+    }
+    if (status == 0) {
+      break; // the replay got through without reaching read k
+    }
+    failure_points += 1;
+  }
+  printf("failed replay: ok, replay failed at %u points\n", failure_points);
+  return true;
+}
+
+/*---------------------------------------------*/
+
+int main () {
+  // the rows, more rows in between them, and what select shows after clean sessions
+  FILE* rows = fopen("waltest_rows.txt", "w");
+  FILE* more = fopen("waltest_more.txt", "w");
+  for (uint32_t i = 0; i < NUM_ROWS; ++i) {
+    fprintf(rows, "insert %u k%05u\n", 2 * i, 2 * i);
+    fprintf(more, "insert %u k%05u\n", 2 * i + 1, 2 * i + 1);
+  }
+  fclose(rows);
+  fclose(more);
+  write_file("waltest_empty.txt", "");
+  write_file("waltest_select.txt", "select\n");
+  remove_db();
+  run_session("waltest_rows.txt", "waltest_out.txt", false, -1, -1);
+  run_session("waltest_select.txt", "waltest_expected.txt", false, -1, -1);
+  run_session("waltest_more.txt", "waltest_out.txt", false, -1, -1);
+  run_session("waltest_select.txt", "waltest_all.txt", false, -1, -1);
+
+  bool ok = test_torn_tail();
+  ok = test_failed_replay() && ok;
+
+  remove_db();
+  unlink("waltest_rows.txt");
+  unlink("waltest_more.txt");
+  unlink("waltest_empty.txt");
+  unlink("waltest_select.txt");
+  unlink("waltest_out.txt");
+  unlink("waltest_expected.txt");
+  unlink("waltest_all.txt");
+  return ok ? 0 : 1;
+}